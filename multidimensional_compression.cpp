@@ -1,4 +1,4 @@
-// -*- compile-command: "g++ -Wall -g -std=c++11 multidimensional_compression.cpp -o multidimensional_compression"; -*-
+// -*- compile-command: "g++ -Wall -g -std=c++17 -pthread multidimensional_compression.cpp -o multidimensional_compression"; -*-
 
 /*
  * This file is part of Multidimensional Compression.
@@ -31,48 +31,257 @@
  */
 
 #include <cstdlib>
+#include <cstdio>
+#include <cerrno>
+#include <cstring>
 #include <iostream>
 #include <fstream>
 #include <sstream>
 
 #include <limits>
 #include <cmath>
+#include <algorithm>
+#include <queue>
+#include <unordered_set>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <charconv>
+#include <chrono>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <netdb.h>
+
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
 
 #include "multidimensional_compression.hpp"
 	
 int main (int argc, char *argv[])
 {
-    srand (time (NULL));
+	Driver driver;
+	if (! driver.parse (argc, argv)) return EXIT_FAILURE;
+	return driver.run ();
+}
 
-	MultiSet *ABC = new MultiSet ("ABC");
 
-	Set *A = new Set (ABC, "A");
-	A->setElements ("A.csv");
 
-	Set *B = new Set (ABC, "B");
-	B->setElements ("B.csv");
-	
-	Set *C = new Set (ABC, "C");
-	C->setElements ("C.csv");
+template <typename T>
+bool Column<T>::mapFile (std::string filename)
+{
+	unmapFile ();
+	std::vector<T>().swap (values);
+	own ();
+
+	fd = open (filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0) { std::cerr << "ERROR: Cannot create column file " << filename << std::endl; return false; }
+	unlink (filename.c_str());
+	return true;
+}
 
-	ABC->buildMultiElements ();
-	ABC->setMultiElements ("ABC.csv");
-	std::cout << ABC->toString(true) << std::endl;
 
-	ABC->buildMultiSubsets ();
-	
-	std::cout << ABC->toString(true) << std::endl;
+template <typename T>
+void Column<T>::unmapFile ()
+{
+	if (fd < 0) return;
+	remap (0);
+	close (fd);
+	fd = -1;
+}
+
+
+template <typename T>
+bool Column<T>::remap (long n)
+{
+	if (pointer != NULL) munmap (pointer, length * sizeof (T));
+	pointer = NULL;
+	length = 0;
+	if (n == 0) return true;
+
+	void *data = MAP_FAILED;
+	if (ftruncate (fd, n * sizeof (T)) == 0) { data = mmap (NULL, n * sizeof (T), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0); }
+	if (data == MAP_FAILED) { std::cerr << "ERROR: Cannot map a column of " << n * sizeof (T) << " bytes" << std::endl; return false; }
+	pointer = (T *) data;
+	length = n;
+	return true;
+}
+
+
+
+std::vector<double> Entropy::xLogs = Entropy::buildTable (true);
+std::vector<double> Entropy::logs = Entropy::buildTable (false);
+
+
+std::vector<double> Entropy::buildTable (bool product)
+{
+	std::vector<double> table (tableSize);
+	for (int n = 0; n < tableSize; n++) {
+		double value = n;
+		if (product) table[n] = (value > 0) ? value * log2 (value) : 0;
+		else table[n] = log2 (value);
+	}
+	return table;
+}
+
+
+void Entropy::xlog2x (const double *values, double *results, long n)
+{
+	long i = 0;
+
+#if defined(__AVX512F__)
+	for (; i + 8 <= n; i += 8) {
+		__m512d value = _mm512_loadu_pd (values + i);
+		__m256i index = _mm512_maskz_cvttpd_epi32 (0xFF, value);
+		__mmask8 exact = _mm512_cmp_pd_mask (_mm512_maskz_cvtepi32_pd (0xFF, index), value, _CMP_EQ_OQ)
+			& _mm512_cmp_pd_mask (value, _mm512_setzero_pd (), _CMP_GE_OQ)
+			& _mm512_cmp_pd_mask (value, _mm512_set1_pd (tableSize), _CMP_LT_OQ);
+		if (exact != 0xFF) { for (int h = 0; h < 8; h++) { results[i+h] = xlog2x (values[i+h]); } continue; }
+		_mm512_storeu_pd (results + i, _mm512_mask_i32gather_pd (_mm512_setzero_pd (), exact, index, xLogs.data(), 8));
+	}
+#elif defined(__AVX2__)
+	for (; i + 4 <= n; i += 4) {
+		__m256d value = _mm256_loadu_pd (values + i);
+		__m128i index = _mm256_cvttpd_epi32 (value);
+		__m256d exact = _mm256_and_pd (_mm256_cmp_pd (_mm256_cvtepi32_pd (index), value, _CMP_EQ_OQ),
+			_mm256_and_pd (_mm256_cmp_pd (value, _mm256_setzero_pd (), _CMP_GE_OQ), _mm256_cmp_pd (value, _mm256_set1_pd (tableSize), _CMP_LT_OQ)));
+		if (_mm256_movemask_pd (exact) != 0xF) { for (int h = 0; h < 4; h++) { results[i+h] = xlog2x (values[i+h]); } continue; }
+		_mm256_storeu_pd (results + i, _mm256_mask_i32gather_pd (_mm256_setzero_pd (), xLogs.data(), index, exact, 8));
+	}
+#endif
+
+	for (; i < n; i++) { results[i] = xlog2x (values[i]); }
+}
+
+
+std::mutex Profile::mutex;
+std::vector<std::string> Profile::phaseNames;
+std::map<std::string,std::array<double,3>> Profile::phases;
+
+std::atomic<long> Profile::lossVisits {0};
+std::atomic<long> Profile::lossPrunes {0};
+std::atomic<long> Profile::lossMemoHits {0};
+std::atomic<long> Profile::costVisits {0};
+std::atomic<long> Profile::costPrunes {0};
+std::atomic<long> Profile::costMemoHits {0};
+
+
+Profile::Profile (std::string vPhase) : phase (vPhase), wallBegin (getWallTime ()), cpuBegin (getCpuTime ()) {}
+
+
+Profile::~Profile ()
+{
+	double wallTime = getWallTime () - wallBegin;
+	double cpuTime = getCpuTime () - cpuBegin;
+
+	std::lock_guard<std::mutex> lock (mutex);
+	std::map<std::string,std::array<double,3>>::iterator it = phases.find (phase);
+	if (it == phases.end()) {
+		phaseNames.push_back (phase);
+		it = phases.insert (std::pair<std::string,std::array<double,3>> (phase, {0, 0, 0})).first;
+	}
+	it->second[0]++;
+	it->second[1] += wallTime;
+	it->second[2] += cpuTime;
+}
+
+
+double Profile::getWallTime () { return std::chrono::duration<double> (std::chrono::steady_clock::now().time_since_epoch()).count(); }
+
+
+double Profile::getCpuTime ()
+{
+	struct timespec time;
+	clock_gettime (CLOCK_PROCESS_CPUTIME_ID, &time);
+	return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+
+long Profile::getPeakRss ()
+{
+	struct rusage usage;
+	getrusage (RUSAGE_SELF, &usage);
+	return usage.ru_maxrss * 1024L;
+}
 
-	std::cout << ABC->getMultiPartition(100)->toString(true) << std::endl;
 
-	return EXIT_SUCCESS;
+void Profile::reset ()
+{
+	std::lock_guard<std::mutex> lock (mutex);
+	phaseNames.clear ();
+	phases.clear ();
+	for (std::atomic<long> *counter : {&lossVisits, &lossPrunes, &lossMemoHits, &costVisits, &costPrunes, &costMemoHits}) { *counter = 0; }
 }
 
 
+void Profile::report (std::ostream &output, MultiSet *multiSet)
+{
+	std::lock_guard<std::mutex> lock (mutex);
+	std::streamsize precision = output.precision (9);
+
+	output << "{\"phases\":{";
+	for (unsigned int p = 0; p < phaseNames.size(); p++) {
+		std::array<double,3> &phase = phases[phaseNames[p]];
+		output << (p > 0 ? "," : "") << "\"" << phaseNames[p] << "\":{\"calls\":" << (long) phase[0] << ",\"wall\":" << phase[1] << ",\"cpu\":" << phase[2] << "}";
+	}
+	output << "},\"peakRss\":" << getPeakRss ();
+
+	output << ",\"counters\":{\"lossVisits\":" << lossVisits << ",\"lossPrunes\":" << lossPrunes << ",\"lossMemoHits\":" << lossMemoHits
+		   << ",\"costVisits\":" << costVisits << ",\"costPrunes\":" << costPrunes << ",\"costMemoHits\":" << costMemoHits << "}";
+
+	if (multiSet != NULL) {
+		Lattice *lattice = multiSet->lattice;
+		long multiSubsetNb = (lattice != NULL) ? lattice->multiSubsetNb : multiSet->multiSubsets.size();
+		long multiPartitionNb = (lattice != NULL) ? lattice->multiPartitionNb : multiSet->multiPartitionPool.size();
+		long cellNb = multiSet->sparse ? multiSet->sparseMultiElements.size() : (multiSet->cellIds.empty() ? multiSet->multiElements.size() : multiSet->cellIds.size());
+		output << ",\"model\":{\"dimensions\":" << multiSet->dim << ",\"multiElements\":" << multiSet->multiElementNb << ",\"cells\":" << cellNb
+			   << ",\"multiSubsets\":" << multiSubsetNb << ",\"multiPartitions\":" << multiPartitionNb << "}";
+
+		long elementBytes = 0, subsetBytes = 0, partitionBytes = 0;
+		for (Set *set : multiSet->sets) {
+			elementBytes += set->elementPool.bytes ();
+			subsetBytes += set->subsetPool.bytes ();
+			partitionBytes += set->partitionPool.bytes ();
+		}
+
+		long latticeBytes = 0, solverBytes = 0;
+		if (lattice != NULL) {
+			latticeBytes = lattice->order.bytes () + lattice->levelOffsets.bytes () + lattice->multiElementNb.bytes () + lattice->sumValue.bytes () + lattice->sumInfo.bytes ()
+				+ lattice->loss.bytes () + lattice->multiPartitionOffsets.bytes () + lattice->multiSubsetOffsets.bytes () + lattice->multiSubsetIds.bytes ()
+				+ (lattice->prefixValues.capacity() + lattice->prefixInfos.capacity()) * sizeof (double) + (lattice->activeOrder.capacity() + lattice->activeLevelOffsets.capacity()) * sizeof (long);
+
+			std::lock_guard<std::mutex> solverLock (lattice->solverMutex);
+			for (Solver *solver : lattice->solvers) {
+				solverBytes += solver->cost.bytes () + solver->laneCosts.bytes () + solver->multiPartition.bytes () + solver->laneMultiPartitions.bytes ()
+					+ solver->segmentBegins.bytes () + solver->segmentEnds.bytes () + solver->segments.capacity() * sizeof (Segment)
+					+ solver->viewPool.bytes () + solver->resultPool.bytes ();
+			}
+		}
+
+		output << ",\"bytes\":{\"Element\":" << elementBytes << ",\"Subset\":" << subsetBytes << ",\"Partition\":" << partitionBytes
+			   << ",\"MultiElement\":" << multiSet->multiElementPool.bytes () + multiSet->multiElements.capacity() * sizeof (MultiElement*)
+			   << ",\"MultiSubset\":" << multiSet->multiSubsetPool.bytes () + multiSet->multiSubsets.capacity() * sizeof (MultiSubset*)
+			   << ",\"MultiPartition\":" << multiSet->multiPartitionPool.bytes () + multiSet->resultPool.bytes ()
+			   << ",\"cells\":" << multiSet->cellIds.bytes () + multiSet->cellValues.bytes ()
+			   << ",\"Lattice\":" << latticeBytes << ",\"Solver\":" << solverBytes << ",\"snapshot\":" << multiSet->snapshotSize << "}";
+	}
+
+	output << "}" << std::endl;
+	output.precision (precision);
+}
+
 
 Element::Element (Set *vSet, std::string vName) : set (vSet), name (vName)
 {
 	id = set->elementNb++;
+	originalId = id;
 	set->elements.push_back (this);
 	set->elementsByName.insert (std::pair<std::string,Element*> (name, this));
 }
@@ -90,28 +299,28 @@ Set::Set (MultiSet *vMultiSet, std::string vName) : multiSet (vMultiSet), name (
 }
 
 
-void Set::setElements (std::string filename)
+bool Set::setElements (std::string filename)
 {
-	std::ifstream file (filename);
-	std::string line;
+	Profile profile ("setElements");
+	MappedFile file (filename);
+	if (! file.valid) return false;
+	const char *cursor = file.data;
+	std::string_view line, token;
 
-	std::string temp;
 	std::list<std::string> names;
 	Subset *subset = NULL;
 	
-	while (std::getline (file, line))
+	while (MappedFile::nextLine (cursor, file.data + file.size, line))
 	{
-		//std::cout << "LINE: " << line << std::endl;
 		names.clear();
-		std::istringstream iss (line);
-		while (iss >> temp) names.push_back (temp); //		std::cout << "WORD: " << temp << std::endl;}
+		while (MappedFile::nextToken (line, token)) names.push_back (std::string (token));
 
 
 		if (names.size() == 0) continue;
 		
 		if (names.size() == 1) {
-			if (getElement (names.front()) != NULL) { std::cout << "WARNING: Element '" << names.front() << "' appears several times in '" << filename << std::endl; continue; }
-			new Element (this, names.front());
+			if (getElement (names.front()) != NULL) { std::cerr << "WARNING: Element '" << names.front() << "' appears several times in '" << filename << std::endl; continue; }
+			elementPool.create (this, names.front());
 			continue;
 		}
 		
@@ -122,26 +331,408 @@ void Set::setElements (std::string filename)
 		if (subset == NULL) {
 			Element *element = getElement (names.front());
 			if (element != NULL) {
-				if (names.size() > 2) { std::cout << "WARNING: Only one element can be specified for subset '" << subsetName << "' in file " << filename << std::endl; continue; }
-				subset = new Subset (this, subsetName, element);
+				if (names.size() > 2) { std::cerr << "WARNING: Only one element can be specified for subset '" << subsetName << "' in file " << filename << std::endl; continue; }
+				subset = subsetPool.create (this, subsetName, element);
 				continue;
 			}
-			else { subset = new Subset (this, subsetName); }
+			else { subset = subsetPool.create (this, subsetName); }
 		}
 
 		std::list<Subset*> subsets;
 		for (std::string nextSubsetName : names) {
 			Subset *nextSubset = getSubset (nextSubsetName);
-			if (nextSubset == NULL) { std::cout << "WARNING: Unknown subset '" << nextSubsetName << "' after subset '" << subsetName << "' in file " << filename << std::endl; continue; }
+			if (nextSubset == NULL) { std::cerr << "WARNING: Unknown subset '" << nextSubsetName << "' after subset '" << subsetName << "' in file " << filename << std::endl; continue; }
 			subsets.push_back (nextSubset);
 		}
-		new Partition (subset, subsets);
+		partitionPool.create (subset, subsets);
 	}
 
-	if (subset != NULL) { subset->top = true; }
-	else { std::cout << "WARNING: No top subset in file " << filename << std::endl; }
-	
-	file.close();
+	if (elementNb == 0) { std::cerr << "ERROR: No element in file " << filename << std::endl; return false; }
+	if (subset != NULL) { subset->top = true; topSubset = subset; }
+	else { std::cerr << "WARNING: No top subset in file " << filename << std::endl; }
+
+	if (! orderElements ()) { std::cerr << "ERROR: A subset contains itself in file " << filename << std::endl; return false; }
+	return true;
+}
+
+
+bool Set::orderElements ()
+{
+	if (! computeHeights ()) return false;
+
+	std::vector<Element*> orderedElements;
+	orderedElements.reserve (elementNb);
+	std::vector<bool> visited (elementNb, false);
+
+	std::vector<Subset*> subsetStack;
+	if (topSubset != NULL) subsetStack.push_back (topSubset);
+	while (! subsetStack.empty()) {
+		Subset *subset = subsetStack.back();
+		subsetStack.pop_back();
+
+		if (subset->bot) {
+			if (! visited[subset->element->originalId]) { orderedElements.push_back (subset->element); }
+			visited[subset->element->originalId] = true;
+		}
+		else if (subset->partitions.size() > 0) {
+			std::list<Subset*> &nextSubsets = subset->partitions.front()->subsets;
+			for (std::list<Subset*>::reverse_iterator it = nextSubsets.rbegin(); it != nextSubsets.rend(); ++it) { subsetStack.push_back (*it); }
+		}
+	}
+
+	for (Element *element : elements) { if (! visited[element->originalId]) orderedElements.push_back (element); }
+
+	elements = orderedElements;
+	for (int id = 0; id < elementNb; id++) { elements[id]->id = id; }
+
+	std::vector<Subset*> sortedSubsets (subsets);
+	std::stable_sort (sortedSubsets.begin(), sortedSubsets.end(), [] (Subset *a, Subset *b) { return a->height < b->height; });
+
+	std::vector<int> sizes (subsetNb, 0);
+	for (Subset *subset : sortedSubsets) {
+		if (subset->bot) {
+			subset->elementBegin = subset->element->id;
+			subset->elementEnd = subset->element->id + 1;
+			sizes[subset->id] = 1;
+		}
+		else if (subset->partitions.size() > 0) {
+			subset->elementBegin = elementNb;
+			subset->elementEnd = 0;
+			for (Subset *nextSubset : subset->partitions.front()->subsets) {
+				subset->elementBegin = std::min (subset->elementBegin, nextSubset->elementBegin);
+				subset->elementEnd = std::max (subset->elementEnd, nextSubset->elementEnd);
+				sizes[subset->id] += sizes[nextSubset->id];
+			}
+		}
+		subset->contiguous = (sizes[subset->id] > 0 && sizes[subset->id] == subset->elementEnd - subset->elementBegin);
+	}
+	return true;
+}
+
+
+void Set::setOrdered (int stepNb, int vMaxLength, int vGranularity)
+{
+	ordered = true;
+	maxLength = (vMaxLength <= 0 || vMaxLength > stepNb) ? stepNb : vMaxLength;
+	granularity = std::max (1, vGranularity);
+	blockNb = (stepNb + maxLength - 1) / maxLength;
+
+	for (int t = 0; t < stepNb; t++) { elementPool.create (this, std::to_string (t)); }
+
+	int lastLength = stepNb - (blockNb - 1) * maxLength;
+	lengthOffsets.assign (maxLength + 2, 0);
+	for (int length = 1; length <= maxLength; length++) {
+		int intervalNb = (blockNb - 1) * (maxLength - length + 1) + std::max (0, lastLength - length + 1);
+		lengthOffsets[length+1] = lengthOffsets[length] + intervalNb;
+	}
+
+	subsetNb = lengthOffsets[maxLength+1];
+	if (blockNb > 1) subsetNb++;
+
+	intervalSubsets.clear ();
+	buildPartitions ();
+}
+
+
+void Set::setTree (int leafNb, int arity, int alternativeNb)
+{
+	std::vector<Subset*> level;
+	for (int e = 0; e < leafNb; e++) {
+		Element *element = elementPool.create (this, "e" + std::to_string (e));
+		level.push_back (subsetPool.create (this, "E" + std::to_string (e), element));
+	}
+
+	arity = std::max (2, arity);
+	for (int height = 1; level.size() > 1; height++) {
+		std::vector<Subset*> nextLevel;
+		for (unsigned int begin = 0; begin < level.size(); begin += arity) {
+			unsigned int end = std::min ((unsigned int) level.size(), begin + arity);
+			if (end - begin == 1) { nextLevel.push_back (level[begin]); continue; }
+
+			Subset *subset = subsetPool.create (this, "N" + std::to_string (height) + "_" + std::to_string (begin / arity));
+			std::list<Subset*> children (level.begin() + begin, level.begin() + end);
+			partitionPool.create (subset, children);
+
+			int partitionNb = 0;
+			for (Subset *child : children) {
+				if (partitionNb == alternativeNb) break;
+				if (child->partitions.empty()) continue;
+
+				std::list<Subset*> subsets;
+				for (Subset *nextChild : children) {
+					if (nextChild == child) { subsets.insert (subsets.end(), child->partitions.front()->subsets.begin(), child->partitions.front()->subsets.end()); }
+					else { subsets.push_back (nextChild); }
+				}
+				partitionPool.create (subset, subsets);
+				partitionNb++;
+			}
+
+			nextLevel.push_back (subset);
+		}
+		level = nextLevel;
+	}
+
+	if (! level.empty()) { topSubset = level.front(); topSubset->top = true; }
+	orderElements ();
+}
+
+
+void Set::setSubtree (Set *set, Subset *subset, bool collapse)
+{
+	if (collapse) {
+		topSubset = subsetPool.create (this, subset->name, elementPool.create (this, subset->name));
+		topSubset->top = true;
+		orderElements ();
+		return;
+	}
+
+	std::vector<Subset*> copies (set->subsetNb, NULL);
+	std::function<Subset* (Subset*)> copy = [&] (Subset *original) {
+		if (copies[original->id] != NULL) return copies[original->id];
+
+		Subset *copied;
+		if (original->bot) { copied = subsetPool.create (this, original->name, elementPool.create (this, original->element->name)); }
+		else {
+			std::vector<std::list<Subset*>> partitions;
+			for (Partition *partition : original->partitions) {
+				std::list<Subset*> subsets;
+				for (Subset *child : partition->subsets) { subsets.push_back (copy (child)); }
+				partitions.push_back (subsets);
+			}
+			copied = subsetPool.create (this, original->name);
+			for (std::list<Subset*> &subsets : partitions) { partitionPool.create (copied, subsets); }
+		}
+		return copies[original->id] = copied;
+	};
+
+	topSubset = copy (subset);
+	topSubset->top = true;
+	for (Element *element : set->elements) { if (getElement (element->name) == NULL) foreignElements.push_back (element->name); }
+	orderElements ();
+}
+
+
+void Set::setWindow (int stepNb)
+{
+	setOrdered (stepNb);
+	windowed = true;
+	origin = 0;
+}
+
+
+int Set::slideWindow (std::string name)
+{
+	int slot = origin++ % elementNb;
+
+	Element *element = elements[slot];
+	elementsByName.erase (element->name);
+	element->name = name;
+	elementsByName.insert (std::pair<std::string,Element*> (name, element));
+
+	for (std::pair<const int,Subset*> &it : intervalSubsets) { subsetPool.release (it.second); }
+	intervalSubsets.clear ();
+	return slot;
+}
+
+
+int Set::getIntervalId (int begin, int length)
+{
+	if (windowed) return lengthOffsets[length] + (origin + begin) % (maxLength - length + 1);
+
+	int block = begin / maxLength;
+	return lengthOffsets[length] + block * (maxLength - length + 1) + begin - block * maxLength;
+}
+
+
+void Set::getInterval (int id, int &begin, int &length)
+{
+	if (id == lengthOffsets[maxLength+1]) { begin = 0; length = elementNb; return; }
+
+	length = std::upper_bound (lengthOffsets.begin() + 1, lengthOffsets.end(), id) - lengthOffsets.begin() - 1;
+	int index = id - lengthOffsets[length];
+	if (windowed) { int intervalNb = maxLength - length + 1; begin = (index - origin % intervalNb + intervalNb) % intervalNb; return; }
+
+	int block = std::min (blockNb - 1, index / (maxLength - length + 1));
+	begin = block * maxLength + index - block * (maxLength - length + 1);
+}
+
+
+int Set::getTopId ()
+{
+	if (ordered) return (blockNb > 1) ? lengthOffsets[maxLength+1] : getIntervalId (0, elementNb);
+	return (topSubset != NULL) ? topSubset->id : 0;
+}
+
+
+int Set::getHeight (int id)
+{
+	if (! ordered) return subsets[id]->height;
+	if (id == lengthOffsets[maxLength+1]) return maxLength;
+
+	int begin, length;
+	getInterval (id, begin, length);
+	return length - 1;
+}
+
+
+int Set::getElementId (int id)
+{
+	if (! ordered) return subsets[id]->bot ? subsets[id]->element->id : -1;
+	return (id < lengthOffsets[2]) ? id : -1;
+}
+
+
+bool Set::isContiguous (int id) { return ordered || subsets[id]->contiguous; }
+
+
+void Set::getElementRange (int id, int &begin, int &end)
+{
+	if (! ordered) { begin = subsets[id]->elementBegin; end = subsets[id]->elementEnd; return; }
+
+	int length;
+	getInterval (id, begin, length);
+	if (windowed) { begin = (origin + begin) % elementNb; }
+	end = begin + length;
+}
+
+
+int Set::getPartitionNb (int id)
+{
+	if (! ordered) return partitionOffsets[id+1] - partitionOffsets[id];
+	if (id == lengthOffsets[maxLength+1]) return 1;
+
+	int begin, length;
+	getInterval (id, begin, length);
+	if (length == 1) return 0;
+	if (begin / granularity == (begin + length - 1) / granularity) return length - 1;
+	return (begin + length - 1) / granularity - begin / granularity;
+}
+
+
+int Set::getPartitionSubsets (int id, int p, long *ids)
+{
+	if (! ordered) {
+		int partition = partitionOffsets[id] + p;
+		int size = subsetOffsets[partition+1] - subsetOffsets[partition];
+		for (int c = 0; c < size; c++) { ids[c] = subsetIds[subsetOffsets[partition] + c]; }
+		return size;
+	}
+
+	if (id == lengthOffsets[maxLength+1]) {
+		for (int block = 0; block < blockNb; block++) {
+			int begin = block * maxLength;
+			ids[block] = getIntervalId (begin, std::min (maxLength, elementNb - begin));
+		}
+		return blockNb;
+	}
+
+	int begin, length;
+	getInterval (id, begin, length);
+
+	int cut = begin + 1 + p;
+	if (begin / granularity != (begin + length - 1) / granularity) cut = (begin / granularity + 1 + p) * granularity;
+
+	ids[0] = getIntervalId (begin, cut - begin);
+	ids[1] = getIntervalId (cut, begin + length - cut);
+	return 2;
+}
+
+
+void Set::getContainingSubsets (int elementId, std::vector<int> &ids)
+{
+	ids.clear ();
+
+	if (ordered) {
+		if (windowed) { elementId = (elementId - origin % elementNb + elementNb) % elementNb; }
+		int blockBegin = elementId / maxLength * maxLength;
+		int blockEnd = std::min (elementNb, blockBegin + maxLength);
+		for (int length = 1; length <= blockEnd - blockBegin; length++) {
+			for (int begin = std::max (blockBegin, elementId - length + 1); begin <= std::min (elementId, blockEnd - length); begin++) { ids.push_back (getIntervalId (begin, length)); }
+		}
+		if (blockNb > 1) { ids.push_back (lengthOffsets[maxLength+1]); }
+		return;
+	}
+
+	if (elementSubsets.empty()) {
+		elementSubsets.resize (elementNb);
+		for (Subset *subset : subsets) {
+			std::list<Element*> subsetElements;
+			subset->getElements (subsetElements);
+			for (Element *element : subsetElements) { elementSubsets[element->id].push_back (subset->id); }
+		}
+	}
+
+	ids = elementSubsets[elementId];
+}
+
+
+void Set::buildPartitions ()
+{
+	partitionNb = 0;
+	partitionSubsetNb = 0;
+	maxPartitionSize = 0;
+	partitionOffsets.clear ();
+	subsetOffsets.clear ();
+	subsetIds.clear ();
+
+	if (ordered) {
+		for (int id = 0; id < subsetNb; id++) { partitionNb += getPartitionNb (id); }
+		partitionSubsetNb = 2 * partitionNb;
+		maxPartitionSize = (maxLength > 1) ? 2 : 0;
+		if (blockNb > 1) {
+			partitionSubsetNb += blockNb - 2;
+			maxPartitionSize = std::max (maxPartitionSize, blockNb);
+		}
+		return;
+	}
+
+	for (Subset *subset : subsets) {
+		partitionOffsets.push_back (partitionNb);
+		for (Partition *partition : subset->partitions) {
+			subsetOffsets.push_back (subsetIds.size());
+			for (Subset *nextSubset : partition->subsets) { subsetIds.push_back (nextSubset->id); }
+			maxPartitionSize = std::max (maxPartitionSize, (int) partition->subsets.size());
+			partitionNb++;
+		}
+	}
+
+	partitionOffsets.push_back (partitionNb);
+	subsetOffsets.push_back (subsetIds.size());
+	partitionSubsetNb = subsetIds.size();
+
+	computeHeights ();
+}
+
+
+bool Set::computeHeights ()
+{
+	for (Subset *subset : subsets) { subset->height = -1; }
+
+	std::vector<Subset*> subsetStack;
+	for (Subset *rootSubset : subsets) {
+		if (rootSubset->height >= 0) continue;
+		subsetStack.push_back (rootSubset);
+
+		while (! subsetStack.empty()) {
+			Subset *subset = subsetStack.back();
+			if (subset->height >= 0) { subsetStack.pop_back(); continue; }
+
+			// Subsets waiting for their children are marked -2, so meeting one again below itself is a cycle.
+			subset->height = -2;
+			bool ready = true;
+			int height = 0;
+			for (Partition *partition : subset->partitions) {
+				for (Subset *nextSubset : partition->subsets) {
+					if (nextSubset->height == -2) return false;
+					if (nextSubset->height < 0) { subsetStack.push_back (nextSubset); ready = false; }
+					else { height = std::max (height, nextSubset->height + 1); }
+				}
+			}
+
+			if (ready) { subset->height = height; subsetStack.pop_back(); }
+		}
+	}
+	return true;
 }
 
 
@@ -149,16 +740,39 @@ Element *Set::getElement (int id) { return elements[id]; }
 
 Element *Set::getElement (std::string name)
 {
-	std::map<std::string,Element*>::iterator it = elementsByName.find (name);
+	std::unordered_map<std::string,Element*>::iterator it = elementsByName.find (name);
 	if (it == elementsByName.end()) return NULL;
 	return it->second;
 }
 
-Subset *Set::getSubset (int id) { return subsets[id]; }
+Subset *Set::getSubset (int id)
+{
+	if (! ordered) return subsets[id];
+	std::lock_guard<std::mutex> lock (subsetMutex);
+
+	std::map<int,Subset*>::iterator it = intervalSubsets.find (id);
+	if (it != intervalSubsets.end()) return it->second;
+
+	int begin, end;
+	getElementRange (id, begin, end);
+	std::string name = "[" + elements[begin]->name + "," + elements[(end - 1) % elementNb]->name + "]";
+
+	Subset *subset = subsetPool.create (this, id, name);
+	subset->top = (id == getTopId ());
+	subset->bot = (end - begin == 1);
+	if (subset->bot) subset->element = elements[begin];
+	subset->height = getHeight (id);
+	subset->contiguous = (end <= elementNb);
+	subset->elementBegin = begin;
+	subset->elementEnd = end;
+
+	intervalSubsets.insert (std::pair<int,Subset*> (id, subset));
+	return subset;
+}
 
 Subset *Set::getSubset (std::string name)
 {
-	std::map<std::string,Subset*>::iterator it = subsetsByName.find (name);
+	std::unordered_map<std::string,Subset*>::iterator it = subsetsByName.find (name);
 	if (it == subsetsByName.end()) return NULL;
 	return it->second;
 }
@@ -195,11 +809,14 @@ Subset::Subset (Set *vSet, std::string vName, bool vTop) : set (vSet), name (vNa
 
 Subset::Subset (Set *vSet, std::string vName, Element *vElement, bool vTop) : Subset (vSet, vName, vTop) { element = vElement; bot = true; }
 
+Subset::Subset (Set *vSet, int vId, std::string vName) : set (vSet), name (vName), id (vId) {}
+
 
 
 void Subset::getElements (std::list<Element*> &elements)
 {
-	if (bot) { elements.push_back (element); }
+	if (contiguous) { elements.insert (elements.end(), set->elements.begin() + elementBegin, set->elements.begin() + elementEnd); }
+	else if (bot) { elements.push_back (element); }
 	else {
 		if (partitions.size() == 0) { std::cerr << "ERROR: No partition found on intermediate subset '" << name << "' of set '" << set->name << "'" << std::endl; return; }
 		for (Subset *subset : partitions.front()->subsets) { subset->getElements (elements); }
@@ -284,7 +901,15 @@ std::string MultiElement::toString (bool rec)
 
 
 
-MultiSet::MultiSet (std::string vName) : name (vName) {}
+MultiSet::MultiSet (std::string vName, bool vSparse) : name (vName), sparse (vSparse) {}
+
+
+MultiSet::~MultiSet ()
+{
+	delete lattice;
+	for (Set *set : sets) { delete set; }
+	if (snapshot != NULL) { munmap (snapshot, snapshotSize); }
+}
 
 
 Set *MultiSet::getSet (std::string name) { return setsByName.at (name); }
@@ -293,20 +918,26 @@ Set *MultiSet::getSet (std::string name) { return setsByName.at (name); }
 void MultiSet::buildMultiElements ()
 {
 	multiElementNb = 1;
-	for (int d = 0; d < dim; d++) multiElementNb *= sets[d]->elementNb;
-		
+	elementStrides.assign (dim, 1);
+	for (int d = 0; d < dim; d++) {
+		elementStrides[d] = multiElementNb;
+		multiElementNb *= sets[d]->elementNb;
+	}
+
+	sparseMultiElements.clear ();
 	multiElements.clear ();
+	multiElementPool.clear ();
+	if (sparse) return;
+
 	multiElements.reserve (multiElementNb);
 
-	std::vector<std::vector<Element*>::iterator> elementIterators;
-	elementIterators.reserve (dim);
-	
+	std::vector<std::vector<Element*>::iterator> elementIterators (dim);
 	for (int d = 0; d < dim; d++) elementIterators[d] = sets[d]->elements.begin();
 
-	int id = 0;
+	long id = 0;
 	bool stop = false;
 	do {
-		MultiElement *multiElement = new MultiElement (0);
+		MultiElement *multiElement = multiElementPool.create (0);
 		for (int d = 0; d < dim; d++) multiElement->addElement (* (elementIterators[d]));
 		multiElement->id = id++;
 		multiElement->multiSet = this;
@@ -323,134 +954,708 @@ void MultiSet::buildMultiElements ()
 }
 
 
-MultiElement *MultiSet::getMultiElement (std::list<Element*>::iterator *elementIterators) {
-	int id = 0;
+MultiElement *MultiSet::getMultiElement (std::list<Element*>::iterator *elementIterators) { return getMultiElement (getMultiElementId (elementIterators)); }
+
+
+long MultiSet::getMultiElementId (std::list<Element*>::iterator *elementIterators) {
+	long id = 0;
 	for (int d = dim-1; d >= 0; d--) {
 		id *= sets[d]->elementNb;
 		id += (*elementIterators[d])->id;
 	}
-	return multiElements[id];
+	return id;
 }
 
 
-MultiElement *MultiSet::getMultiElement (std::string *names) {
-	int id = 0;
+MultiElement *MultiSet::getMultiElement (std::string *names) { return getMultiElement (getMultiElementId (names)); }
+
+
+long MultiSet::getMultiElementId (std::string *names) {
+	long id = 0;
 	for (int d = dim-1; d >= 0; d--) {
 		id *= sets[d]->elementNb;
 		id += sets[d]->getElement (names[d])->id;
 	}
-	return multiElements[id];
+	return id;
 }
-	
 
-void MultiSet::setMultiElement (std::string *names, double value)
+
+MultiElement *MultiSet::getMultiElement (long id)
 {
-	getMultiElement(names)->value = value;
+	unmapMultiElements ();
+	if (! sparse) return multiElements[id];
+	
+	std::unordered_map<long,MultiElement*>::iterator it = sparseMultiElements.find (id);
+	if (it == sparseMultiElements.end()) return NULL;
+	return it->second;
 }
 
 
-void MultiSet::setMultiElements (std::string filename)
+double MultiSet::getValue (long id)
 {
-	std::ifstream file (filename);
-	std::string line;
-	std::string *cells = new std::string [dim];
-	double value;
+	if (! cellIds.empty()) {
+		long *it = std::lower_bound (cellIds.begin(), cellIds.end(), id);
+		return (it != cellIds.end() && *it == id) ? cellValues[it - cellIds.begin()] : 0;
+	}
+
+	MultiElement *multiElement = getMultiElement (id);
+	if (multiElement == NULL) return 0;
+	return multiElement->value;
+}
 	
-	while (std::getline (file, line))
-	{
-		std::istringstream iss (line);
-		for (int d = 0; d < dim; d++) { if (! (iss >> cells[d])) break; }
-		if (! (iss >> value)) break;
 
-		setMultiElement (cells, value);
+void MultiSet::aggregate (Subset * const *subsets, double &value, double &info, long &elementNb)
+{
+	value = 0;
+	info = 0;
+	elementNb = 0;
+
+	long id = 0;
+	for (int d = 0; d < dim; d++) {
+		if (! subsets[d]->bot) { aggregate (subsets, dim-1, subsets[dim-1], 0, value, info, elementNb); return; }
+		id += subsets[d]->element->id * elementStrides[d];
 	}
 
-	file.close();
-	delete [] cells;
+	value = getValue (id);
+	if (value > 0) { info = - Entropy::xlog2x (value); }
+	elementNb = 1;
 }
 
 
-void MultiSet::buildMultiSubsets ()
+void MultiSet::aggregate (Subset * const *subsets, int d, Subset *subset, long id, double &value, double &info, long &elementNb)
 {
-	multiSubsetNb = 1;
-	for (int d = 0; d < dim; d++) multiSubsetNb *= sets[d]->subsetNb;
+	if (subset->contiguous && d > 0) {
+		for (int e = subset->elementBegin; e < subset->elementEnd; e++) { aggregate (subsets, d-1, subsets[d-1], id + e * elementStrides[d], value, info, elementNb); }
+		return;
+	}
 
-	multiSubsets.clear ();
-	multiSubsets.reserve (multiSubsetNb);
+	if (subset->contiguous) {
+		for (int e = subset->elementBegin; e < subset->elementEnd; e++) {
+			double nextValue = getValue (id + e);
+			value += nextValue;
+			if (nextValue > 0) { info -= Entropy::xlog2x (nextValue); }
+		}
+		elementNb += subset->elementEnd - subset->elementBegin;
+		return;
+	}
 
-	std::vector<std::vector<Subset*>::iterator> subsetIterators;
-	subsetIterators.reserve (dim);
-			
-	for (int d = 0; d < dim; d++) subsetIterators[d] = sets[d]->subsets.begin();
+	if (subset->bot) {
+		id += subset->element->id * elementStrides[d];
+		if (d > 0) { aggregate (subsets, d-1, subsets[d-1], id, value, info, elementNb); return; }
 
-	int id = 0;
-	bool stop = false;
-	do {
-		MultiSubset *multiSubset = new MultiSubset (this);
-		multiSubsets.push_back (multiSubset);
+		double nextValue = getValue (id);
+		value += nextValue;
+		if (nextValue > 0) { info -= Entropy::xlog2x (nextValue); }
+		elementNb++;
+		return;
+	}
 
-		multiSubset->id = id++;
-		multiSubset->top = true;
-		multiSubset->bot = true;
-		for (int d = 0; d < dim; d++) {
-			multiSubset->addSubset (*subsetIterators[d]);
-			multiSubset->top = multiSubset->top && (*subsetIterators[d])->top;
-			multiSubset->bot = multiSubset->bot && (*subsetIterators[d])->bot;
-		}
+	if (subset->partitions.size() == 0) { std::cerr << "ERROR: No partition found on intermediate subset '" << subset->name << "' of set '" << subset->set->name << "'" << std::endl; return; }
+	for (Subset *nextSubset : subset->partitions.front()->subsets) { aggregate (subsets, d, nextSubset, id, value, info, elementNb); }
+}
 
-		if (multiSubset->top) topMultiSubset = multiSubset;
 
-		stop = true;
-		for (int d = 0; d < dim; d++) {
-			subsetIterators[d]++;
-			if (subsetIterators[d] != sets[d]->subsets.end()) { stop = false; d = dim; }
-			else { subsetIterators[d] = sets[d]->subsets.begin(); }
-		}
-	} while (! stop);
-	
-	for (MultiSubset *multiSubset : multiSubsets) {
-		multiSubset->multiPartitions.clear();
+void MultiSet::setMultiElement (std::string *names, double value) { setMultiElement (getMultiElementId (names), value); }
 
-		std::cout << multiSubset->toString() << std::endl;
-	
-		std::vector<Subset*> buildingSubsets (multiSubset->subsets);
-		for (int d = 0; d < multiSubset->dim; d++) {
-			for (Partition *partition : multiSubset->subsets[d]->partitions) {
-				MultiPartition *multiPartition = new MultiPartition (dim);
-				multiSubset->multiPartitions.push_back (multiPartition);
-				
-				for (Subset *subset : partition->subsets) {
-					buildingSubsets[d] = subset;
-					multiPartition->addMultiSubset (getMultiSubset (buildingSubsets));
-				}
-			}
-			
-			buildingSubsets[d] = multiSubset->subsets[d];
-		}
+
+void MultiSet::setMultiElement (long id, double value)
+{
+	unmapMultiElements ();
+	if (! sparse) { multiElements[id]->value = value; return; }
+
+	std::unordered_map<long,MultiElement*>::iterator it = sparseMultiElements.find (id);
+	if (it != sparseMultiElements.end()) {
+		if (value != 0) { it->second->value = value; }
+		else { multiElementPool.release (it->second); sparseMultiElements.erase (it); }
+		return;
 	}
 
-	topMultiSubset->computeLoss();
-	for (MultiSubset *multiSubset : multiSubsets) { multiSubset->loss /= topMultiSubset->sumValue; }
+	if (value == 0) return;
+	
+	MultiElement *multiElement = multiElementPool.create (value);
+	for (int d = 0; d < dim; d++) multiElement->addElement (sets[d]->getElement ((id / elementStrides[d]) % sets[d]->elementNb));
+	multiElement->id = id;
+	multiElement->multiSet = this;
+	sparseMultiElements.insert (std::pair<long,MultiElement*> (id, multiElement));
 }
 
 
-MultiSubset *MultiSet::getMultiSubset (std::vector<Subset*> subsets)
+bool MultiSet::setMultiElements (std::string filename, int threadNb)
 {
-	int id = 0;
-	for (int d = dim-1; d >= 0; d--) {
-		id *= sets[d]->subsetNb;
-		id += sets[d]->getSubset (subsets[d]->id)->id;
+	Profile profile ("setMultiElements");
+	std::vector<std::pair<long,double>> cells;
+	if (! readMultiElements (filename, cells, threadNb)) return false;
+	for (std::pair<long,double> &cell : cells) { setMultiElement (cell.first, cell.second); }
+	return true;
+}
+
+
+bool MultiSet::readMultiElements (std::string filename, std::vector<std::pair<long,double>> &cells, int threadNb)
+{
+	MappedFile file (filename);
+	cells.clear ();
+	if (! file.valid) return false;
+	if (threadNb <= 0) threadNb = std::max (1, (int) std::thread::hardware_concurrency());
+
+	std::vector<std::unordered_map<std::string_view,int>> elementIds (dim);
+	for (int d = 0; d < dim; d++) {
+		for (Element *element : sets[d]->elements) { elementIds[d].insert (std::pair<std::string_view,int> (element->name, element->id)); }
+		for (std::string &name : sets[d]->foreignElements) { elementIds[d].insert (std::pair<std::string_view,int> (name, -1)); }
+	}
+
+	std::vector<const char *> bounds (threadNb + 1, file.data + file.size);
+	bounds[0] = file.data;
+	for (int t = 1; t < threadNb; t++) {
+		const char *bound = std::max (bounds[t-1], (const char *) file.data + file.size * t / threadNb);
+		if (bound > file.data && bound < file.data + file.size && bound[-1] != '\n') {
+			bound = (const char *) memchr (bound, '\n', file.data + file.size - bound);
+			bound = (bound == NULL) ? file.data + file.size : bound + 1;
+		}
+		bounds[t] = bound;
+	}
+
+	std::vector<std::vector<std::pair<long,double>>> chunks (threadNb);
+	std::vector<std::string> warnings (threadNb);
+	std::vector<char> stopped (threadNb, false);
+
+	auto parse = [&] (int t) {
+		const char *cursor = bounds[t];
+		std::string_view line, token;
+		while (MappedFile::nextLine (cursor, bounds[t+1], line)) {
+			long id = 0;
+			bool known = true;
+			int d = 0;
+			for (; d < dim && MappedFile::nextToken (line, token); d++) {
+				std::unordered_map<std::string_view,int>::iterator it = elementIds[d].find (token);
+				if (it != elementIds[d].end() && it->second >= 0) { id += it->second * elementStrides[d]; continue; }
+				if (it != elementIds[d].end()) { known = false; continue; }
+				if (known) { warnings[t] += "WARNING: Unknown element '" + std::string (token) + "' of set '" + sets[d]->name + "' in file " + filename + "\n"; }
+				known = false;
+			}
+
+			double value;
+			if (d < dim || ! MappedFile::nextToken (line, token) || std::from_chars (token.data(), token.data() + token.size(), value).ec != std::errc()) { stopped[t] = true; return; }
+			if (known) { chunks[t].push_back (std::pair<long,double> (id, value)); }
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (int t = 1; t < threadNb; t++) { threads.push_back (std::thread (parse, t)); }
+	parse (0);
+	for (std::thread &thread : threads) { thread.join(); }
+
+	for (int t = 0; t < threadNb; t++) {
+		std::cerr << warnings[t];
+		cells.insert (cells.end(), chunks[t].begin(), chunks[t].end());
+		if (stopped[t]) break;
+	}
+	return true;
+}
+
+
+void MultiSet::updateMultiElements (const std::vector<std::pair<long,double>> &updates)
+{
+	for (const std::pair<long,double> &update : updates) {
+		double oldValue = getValue (update.first);
+		setMultiElement (update.first, update.second);
+		if (lattice != NULL) { lattice->updateValue (update.first, oldValue, update.second); }
+	}
+
+	if (lattice != NULL || multiSubsets.empty()) return;
+
+	for (MultiSubset *multiSubset : multiSubsets) { multiSubset->loss = std::numeric_limits<double>::quiet_NaN(); }
+	for (MultiSubset *multiSubset : orderedMultiSubsets) { multiSubset->computeLoss(); }
+	for (MultiSubset *multiSubset : multiSubsets) { multiSubset->loss /= topMultiSubset->sumValue; }
+}
+
+
+bool MultiSet::slideWindow (std::string name, std::string filename)
+{
+	int d = 0;
+	while (d < dim && ! sets[d]->windowed) { d++; }
+	if (d == dim) { std::cerr << "ERROR: No windowed set found in '" << this->name << "' (see setWindow)" << std::endl; return false; }
+
+	int slot = sets[d]->slideWindow (name);
+
+	long sliceNb = multiElementNb / sets[d]->elementNb;
+	for (long rest = 0; rest < sliceNb; rest++) {
+		long id = rest % elementStrides[d] + slot * elementStrides[d] + rest / elementStrides[d] * elementStrides[d] * sets[d]->elementNb;
+		setMultiElement (id, 0);
+	}
+
+	bool loaded = (filename == "") || setMultiElements (filename);
+	if (lattice != NULL) { lattice->slideWindow (d); }
+	return loaded;
+}
+
+
+static const char snapshotMagic [8] = {'M', 'D', 'C', 'S', 'N', 'A', 'P', '\0'};
+static const int snapshotByteOrder = 0x01020304;
+static const long snapshotVersion = 3;
+static const long snapshotHeaderSize = 24;
+
+
+template <typename T>
+static void writeColumn (std::ofstream &file, const T *values, long n)
+{
+	static const char padding [8] = {0};
+	file.write ((const char *) &n, sizeof (long));
+	file.write ((const char *) values, n * sizeof (T));
+	file.write (padding, (8 - (n * sizeof (T)) % 8) % 8);
+}
+
+static void writeValue (std::ofstream &file, long value) { file.write ((const char *) &value, sizeof (long)); }
+static void writeString (std::ofstream &file, const std::string &str) { writeColumn (file, str.data(), str.size()); }
+
+
+// Readers set cursor to NULL as soon as a field would run past end, and every later read then fails too.
+template <typename T>
+static T *readColumn (char *&cursor, const char *end, long &n)
+{
+	n = 0;
+	if (cursor == NULL || end - cursor < (long) sizeof (long)) { cursor = NULL; return NULL; }
+	long size = *((long *) cursor);
+	long left = end - cursor - sizeof (long);
+	if (size < 0 || size > left / (long) sizeof (T) || (size * (long) sizeof (T) + 7) / 8 * 8 > left) { cursor = NULL; return NULL; }
+	n = size;
+	T *values = (T *) (cursor + sizeof (long));
+	cursor += sizeof (long) + (n * sizeof (T) + 7) / 8 * 8;
+	return values;
+}
+
+static long readValue (char *&cursor, const char *end)
+{
+	if (cursor == NULL || end - cursor < (long) sizeof (long)) { cursor = NULL; return 0; }
+	long value = *((long *) cursor);
+	cursor += sizeof (long);
+	return value;
+}
+
+static std::string readString (char *&cursor, const char *end)
+{
+	long n;
+	char *str = readColumn<char> (cursor, end, n);
+	return (str == NULL) ? "" : std::string (str, n);
+}
+
+template <typename T>
+static bool validOffsets (const T *offsets, long n, long count, long size)
+{
+	if (offsets == NULL || count < 0 || n != count + 1 || offsets[0] != 0 || offsets[count] != size) { return false; }
+	for (long i = 0; i < count; i++) { if (offsets[i] > offsets[i+1]) { return false; } }
+	return true;
+}
+
+template <typename T>
+static bool validIds (const T *ids, long n, long bound)
+{
+	for (long i = 0; i < n; i++) { if (ids[i] < 0 || ids[i] >= bound) { return false; } }
+	return true;
+}
+
+
+bool MultiSet::saveSnapshot (std::string filename)
+{
+	if (lattice == NULL) { std::cerr << "ERROR: Snapshot of '" << name << "' requires a lattice (see buildLattice)" << std::endl; return false; }
+	if (lattice->outOfCore) { std::cerr << "ERROR: Snapshot of '" << name << "' cannot be taken from an out-of-core lattice" << std::endl; return false; }
+
+	std::ofstream file (filename, std::ios::binary);
+	if (! file) { std::cerr << "ERROR: Cannot write snapshot file " << filename << std::endl; return false; }
+
+	int longSize = sizeof (long);
+	file.write (snapshotMagic, 8);
+	file.write ((const char *) &longSize, sizeof (int));
+	file.write ((const char *) &snapshotByteOrder, sizeof (int));
+	writeValue (file, snapshotVersion);
+	writeValue (file, dim);
+	writeValue (file, sparse);
+
+	for (Set *set : sets) {
+		writeString (file, set->name);
+		writeValue (file, set->ordered);
+		writeValue (file, set->windowed);
+		writeValue (file, set->elementNb);
+		writeValue (file, set->maxLength);
+		writeValue (file, set->granularity);
+		writeValue (file, set->origin);
+		for (Element *element : set->elements) { writeString (file, element->name); }
+		if (set->ordered) continue;
+
+		writeValue (file, set->subsetNb);
+		writeValue (file, set->getTopId ());
+		for (Subset *subset : set->subsets) {
+			writeString (file, subset->name);
+			writeValue (file, subset->bot ? subset->element->id : -1);
+		}
+		writeColumn (file, set->partitionOffsets.data(), set->partitionOffsets.size());
+		writeColumn (file, set->subsetOffsets.data(), set->subsetOffsets.size());
+		writeColumn (file, set->subsetIds.data(), set->subsetIds.size());
+	}
+
+	std::vector<long> ids;
+	std::vector<double> values;
+	if (! cellIds.empty()) {
+		ids.assign (cellIds.begin(), cellIds.end());
+		values.assign (cellValues.begin(), cellValues.end());
+	}
+	else {
+		std::vector<MultiElement*> sortedMultiElements;
+		if (sparse) { for (std::pair<const long,MultiElement*> &it : sparseMultiElements) { sortedMultiElements.push_back (it.second); } }
+		else { sortedMultiElements = multiElements; }
+		std::sort (sortedMultiElements.begin(), sortedMultiElements.end(), [] (MultiElement *a, MultiElement *b) { return a->id < b->id; });
+		for (MultiElement *multiElement : sortedMultiElements) {
+			if (multiElement->value == 0) continue;
+			ids.push_back (multiElement->id);
+			values.push_back (multiElement->value);
+		}
+	}
+	writeColumn (file, ids.data(), ids.size());
+	writeColumn (file, values.data(), values.size());
+
+	writeValue (file, lattice->implicit);
+	writeValue (file, lattice->multiPartitionNb);
+	writeValue (file, lattice->maxPartitionSize);
+	writeValue (file, lattice->topId);
+	writeValue (file, lattice->levelNb);
+	writeValue (file, lattice->fixedNormalization);
+	writeColumn (file, &lattice->normalization, 1);
+	writeColumn (file, lattice->strides.data(), dim);
+	writeColumn (file, lattice->order.data(), lattice->order.size());
+	writeColumn (file, lattice->levelOffsets.data(), lattice->levelOffsets.size());
+	writeColumn (file, lattice->multiElementNb.data(), lattice->multiSubsetNb);
+	writeColumn (file, lattice->sumValue.data(), lattice->multiSubsetNb);
+	writeColumn (file, lattice->sumInfo.data(), lattice->multiSubsetNb);
+	writeColumn (file, lattice->loss.data(), lattice->multiSubsetNb);
+	writeColumn (file, lattice->multiPartitionOffsets.data(), lattice->multiPartitionOffsets.size());
+	writeColumn (file, lattice->multiSubsetOffsets.data(), lattice->multiSubsetOffsets.size());
+	writeColumn (file, lattice->multiSubsetIds.data(), lattice->multiSubsetIds.size());
+
+	file.close();
+	if (! file) { std::cerr << "ERROR: Cannot write snapshot file " << filename << std::endl; return false; }
+	return true;
+}
+
+
+bool MultiSet::loadSnapshot (std::string filename, int threadNb)
+{
+	int fd = open (filename.c_str(), O_RDONLY);
+	struct stat status;
+	if (fd < 0 || fstat (fd, &status) < 0) { std::cerr << "ERROR: Cannot read snapshot file " << filename << std::endl; if (fd >= 0) close (fd); return false; }
+
+	if (status.st_size < snapshotHeaderSize) { std::cerr << "ERROR: File " << filename << " is not a snapshot" << std::endl; close (fd); return false; }
+	char *cursor = (char *) mmap (NULL, status.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close (fd);
+	if (cursor == MAP_FAILED) { std::cerr << "ERROR: Cannot map snapshot file " << filename << std::endl; return false; }
+
+	if (std::string (cursor, 8) != std::string (snapshotMagic, 8) || *((int *) (cursor + 8)) != (int) sizeof (long)
+		|| *((int *) (cursor + 12)) != snapshotByteOrder || *((long *) (cursor + 16)) != snapshotVersion) {
+		std::cerr << "ERROR: File " << filename << " is not a snapshot of version " << snapshotVersion << " for this platform" << std::endl;
+		munmap (cursor, status.st_size);
+		return false;
+	}
+
+	const char *end = cursor + status.st_size;
+	int firstSet = dim;
+	auto fail = [&] () {
+		std::cerr << "ERROR: Snapshot file " << filename << " is truncated or corrupt" << std::endl;
+		delete lattice;
+		lattice = NULL;
+		cellIds.clear ();
+		cellValues.clear ();
+		while (dim > firstSet) { setsByName.erase (sets.back()->name); delete sets.back(); sets.pop_back(); dim--; }
+		munmap (snapshot, snapshotSize);
+		snapshot = NULL;
+		snapshotSize = 0;
+		return false;
+	};
+
+	snapshot = cursor;
+	snapshotSize = status.st_size;
+	cursor += snapshotHeaderSize;
+
+	long setNb = readValue (cursor, end);
+	sparse = readValue (cursor, end);
+	if (cursor == NULL || setNb <= 0 || setNb > (end - cursor) / (long) sizeof (long)) { return fail (); }
+
+	for (int d = 0; d < setNb; d++) {
+		std::string setName = readString (cursor, end);
+		bool ordered = readValue (cursor, end);
+		bool windowed = readValue (cursor, end);
+		long elementNb = readValue (cursor, end);
+		long maxLength = readValue (cursor, end);
+		long granularity = readValue (cursor, end);
+		long origin = readValue (cursor, end);
+		if (cursor == NULL || elementNb <= 0 || elementNb > (end - cursor) / (long) sizeof (long)) { return fail (); }
+		if (ordered && (maxLength <= 0 || maxLength > elementNb || granularity <= 0)) { return fail (); }
+		Set *set = new Set (this, setName);
+
+		if (ordered) {
+			if (windowed) { set->setWindow (elementNb); } else { set->setOrdered (elementNb, maxLength, granularity); }
+			set->origin = origin;
+			set->elementsByName.clear ();
+			for (Element *element : set->elements) {
+				element->name = readString (cursor, end);
+				set->elementsByName.insert (std::pair<std::string,Element*> (element->name, element));
+			}
+			if (cursor == NULL) { return fail (); }
+			continue;
+		}
+
+		for (int e = 0; e < elementNb; e++) { set->elementPool.create (set, readString (cursor, end)); }
+
+		long subsetNb = readValue (cursor, end);
+		long topId = readValue (cursor, end);
+		if (cursor == NULL || subsetNb <= 0 || subsetNb > (end - cursor) / (long) (2 * sizeof (long)) || topId < 0 || topId >= subsetNb) { return fail (); }
+		for (int s = 0; s < subsetNb; s++) {
+			std::string subsetName = readString (cursor, end);
+			long elementId = readValue (cursor, end);
+			if (cursor == NULL || elementId >= elementNb) { return fail (); }
+			if (elementId >= 0) { set->subsetPool.create (set, subsetName, set->elements[elementId], s == topId); }
+			else { set->subsetPool.create (set, subsetName, s == topId); }
+		}
+		set->topSubset = set->subsets[topId];
+
+		long partitionNb, childNb, n;
+		int *partitionOffsets = readColumn<int> (cursor, end, partitionNb);
+		int *subsetOffsets = readColumn<int> (cursor, end, childNb);
+		int *subsetIds = readColumn<int> (cursor, end, n);
+		if (cursor == NULL || ! validOffsets (partitionOffsets, partitionNb, subsetNb, childNb - 1)
+			|| ! validOffsets (subsetOffsets, childNb, childNb - 1, n) || ! validIds (subsetIds, n, subsetNb)) { return fail (); }
+		for (Subset *subset : set->subsets) {
+			for (int p = partitionOffsets[subset->id]; p < partitionOffsets[subset->id+1]; p++) {
+				std::list<Subset*> subsets;
+				for (int c = subsetOffsets[p]; c < subsetOffsets[p+1]; c++) { subsets.push_back (set->subsets[subsetIds[c]]); }
+				set->partitionPool.create (subset, subsets);
+			}
+		}
+		if (! set->orderElements ()) { return fail (); }
+	}
+
+	multiElementNb = 1;
+	elementStrides.assign (dim, 1);
+	for (int d = 0; d < dim; d++) {
+		elementStrides[d] = multiElementNb;
+		multiElementNb *= sets[d]->elementNb;
+	}
+
+	long n, cellNb;
+	long *ids = readColumn<long> (cursor, end, cellNb);
+	double *values = readColumn<double> (cursor, end, n);
+	if (cursor == NULL || n != cellNb || ! validIds (ids, cellNb, multiElementNb)) { return fail (); }
+	cellIds.map (ids, cellNb);
+	cellValues.map (values, cellNb);
+
+	bool implicit = readValue (cursor, end);
+	if (cursor == NULL) { return fail (); }
+	delete lattice;
+	lattice = new Lattice (this, implicit, threadNb);
+	for (Set *set : sets) { set->buildPartitions (); }
+
+	long multiSubsetNb = 1, multiPartitionNb = 0, topId = 0;
+	int maxPartitionSize = 0;
+	std::vector<long> expectedStrides (dim);
+	for (int d = 0; d < dim; d++) {
+		expectedStrides[d] = multiSubsetNb;
+		multiSubsetNb *= sets[d]->subsetNb;
+	}
+	for (int d = 0; d < dim; d++) {
+		multiPartitionNb += sets[d]->partitionNb * (multiSubsetNb / sets[d]->subsetNb);
+		maxPartitionSize = std::max (maxPartitionSize, sets[d]->maxPartitionSize);
+		topId += sets[d]->getTopId () * expectedStrides[d];
+	}
+
+	lattice->multiSubsetNb = multiSubsetNb;
+	lattice->multiPartitionNb = readValue (cursor, end);
+	lattice->maxPartitionSize = readValue (cursor, end);
+	lattice->topId = readValue (cursor, end);
+	lattice->levelNb = readValue (cursor, end);
+	lattice->fixedNormalization = readValue (cursor, end);
+	double *normalization = readColumn<double> (cursor, end, n);
+	if (cursor == NULL || n != 1 || lattice->multiPartitionNb != multiPartitionNb || lattice->maxPartitionSize != maxPartitionSize
+		|| lattice->topId != topId || lattice->levelNb <= 0) { return fail (); }
+	lattice->normalization = *normalization;
+	long *strides = readColumn<long> (cursor, end, n);
+	if (cursor == NULL || n != dim || ! std::equal (strides, strides + n, expectedStrides.begin())) { return fail (); }
+	lattice->strides.assign (strides, strides + n);
+
+	long *order = readColumn<long> (cursor, end, n);
+	if (cursor == NULL || n != multiSubsetNb || ! validIds (order, n, multiSubsetNb)) { return fail (); }
+	std::vector<char> ordered (multiSubsetNb, false);
+	for (long i = 0; i < n; i++) { if (ordered[order[i]]) { return fail (); } ordered[order[i]] = true; }
+	lattice->order.map (order, n);
+	long *levelOffsets = readColumn<long> (cursor, end, n);
+	if (cursor == NULL || ! validOffsets (levelOffsets, n, lattice->levelNb, multiSubsetNb)) { return fail (); }
+	lattice->levelOffsets.map (levelOffsets, n);
+
+	long *multiElementNbs = readColumn<long> (cursor, end, n);
+	if (cursor == NULL || n != multiSubsetNb) { return fail (); }
+	lattice->multiElementNb.map (multiElementNbs, n);
+	double *sumValues = readColumn<double> (cursor, end, n);
+	if (cursor == NULL || n != multiSubsetNb) { return fail (); }
+	lattice->sumValue.map (sumValues, n);
+	double *sumInfos = readColumn<double> (cursor, end, n);
+	if (cursor == NULL || n != multiSubsetNb) { return fail (); }
+	lattice->sumInfo.map (sumInfos, n);
+	double *losses = readColumn<double> (cursor, end, n);
+	if (cursor == NULL || n != multiSubsetNb) { return fail (); }
+	lattice->loss.map (losses, n);
+
+	long partitionNb, childNb;
+	long *multiPartitionOffsets = readColumn<long> (cursor, end, partitionNb);
+	long *multiSubsetOffsets = readColumn<long> (cursor, end, childNb);
+	long *multiSubsetIds = readColumn<long> (cursor, end, n);
+	if (cursor == NULL) { return fail (); }
+	if (implicit && (partitionNb != 0 || childNb != 0 || n != 0)) { return fail (); }
+	if (! implicit && (! validOffsets (multiPartitionOffsets, partitionNb, multiSubsetNb, childNb - 1)
+		|| ! validOffsets (multiSubsetOffsets, childNb, childNb - 1, n) || ! validIds (multiSubsetIds, n, multiSubsetNb))) { return fail (); }
+	lattice->multiPartitionOffsets.map (multiPartitionOffsets, partitionNb);
+	lattice->multiSubsetOffsets.map (multiSubsetOffsets, childNb);
+	lattice->multiSubsetIds.map (multiSubsetIds, n);
+	return true;
+}
+
+
+void MultiSet::unmapMultiElements ()
+{
+	if (cellIds.empty()) return;
+
+	std::vector<long> ids (cellIds.begin(), cellIds.end());
+	std::vector<double> values (cellValues.begin(), cellValues.end());
+	cellIds.clear ();
+	cellValues.clear ();
+
+	buildMultiElements ();
+	for (unsigned long i = 0; i < ids.size(); i++) { setMultiElement (ids[i], values[i]); }
+}
+
+
+void MultiSet::buildMultiSubsets (bool lazy)
+{
+	Profile profile ("buildMultiSubsets");
+	for (Set *set : sets) {
+		if (set->ordered) { std::cerr << "ERROR: Ordered set '" << set->name << "' has no explicit subsets, use buildLattice instead of buildMultiSubsets" << std::endl; return; }
+	}
+
+	lazyMultiSubsets = lazy;
+	multiSubsets.clear ();
+	multiSubsetsById.clear ();
+	orderedMultiSubsets.clear ();
+	topMultiSubset = NULL;
+	resultPool.clear ();
+	multiPartitionPool.clear ();
+	multiSubsetPool.clear ();
+	for (int d = 0; d < dim; d++) sets[d]->computeHeights ();
+
+	if (lazy) {
+		std::vector<Subset*> topSubsets (dim);
+		for (int d = 0; d < dim; d++) { topSubsets[d] = sets[d]->topSubset; }
+		getMultiSubset (topSubsets)->computeLoss ();
+		multiSubsetNb = multiSubsets.size();
+	}
+
+	else {
+		multiSubsetNb = 1;
+		for (int d = 0; d < dim; d++) multiSubsetNb *= sets[d]->subsetNb;
+		multiSubsets.reserve (multiSubsetNb);
+
+		std::vector<std::vector<Subset*>::iterator> subsetIterators (dim);
+		for (int d = 0; d < dim; d++) subsetIterators[d] = sets[d]->subsets.begin();
+
+		std::vector<Subset*> subsets (dim);
+		long id = 0;
+		bool stop = false;
+		do {
+			for (int d = 0; d < dim; d++) { subsets[d] = *subsetIterators[d]; }
+			addMultiSubset (subsets, id++);
+
+			stop = true;
+			for (int d = 0; d < dim; d++) {
+				subsetIterators[d]++;
+				if (subsetIterators[d] != sets[d]->subsets.end()) { stop = false; d = dim; }
+				else { subsetIterators[d] = sets[d]->subsets.begin(); }
+			}
+		} while (! stop);
+	
+		for (MultiSubset *multiSubset : multiSubsets) { multiSubset->buildMultiPartitions (); }
+	}
+
+	orderedMultiSubsets = multiSubsets;
+	std::stable_sort (orderedMultiSubsets.begin(), orderedMultiSubsets.end(), [] (MultiSubset *a, MultiSubset *b) { return a->level < b->level; });
+
+	for (MultiSubset *multiSubset : orderedMultiSubsets) { multiSubset->computeLoss(); }
+	for (MultiSubset *multiSubset : multiSubsets) { multiSubset->loss /= topMultiSubset->sumValue; }
+}
+
+
+MultiSubset *MultiSet::getMultiSubset (const std::vector<Subset*> &subsets)
+{
+	long id = 0;
+	for (int d = dim-1; d >= 0; d--) {
+		id *= sets[d]->subsetNb;
+		id += sets[d]->getSubset (subsets[d]->id)->id;
+	}
+
+	if (! lazyMultiSubsets) return multiSubsets[id];
+
+	std::unordered_map<long,MultiSubset*>::iterator it = multiSubsetsById.find (id);
+	if (it != multiSubsetsById.end()) return it->second;
+	return addMultiSubset (subsets, id);
+}
+
+
+MultiSubset *MultiSet::addMultiSubset (const std::vector<Subset*> &subsets, long id)
+{
+	MultiSubset *multiSubset = multiSubsetPool.create (this);
+	multiSubset->id = id;
+	multiSubset->top = true;
+	multiSubset->bot = true;
+	for (Subset *subset : subsets) {
+		multiSubset->addSubset (subset);
+		multiSubset->top = multiSubset->top && subset->top;
+		multiSubset->bot = multiSubset->bot && subset->bot;
+		multiSubset->level += subset->height;
+	}
+
+	multiSubsets.push_back (multiSubset);
+	if (lazyMultiSubsets) { multiSubsetsById[id] = multiSubset; }
+	if (multiSubset->top) topMultiSubset = multiSubset;
+	return multiSubset;
+}
+
+
+bool MultiSet::buildLattice (bool implicit, int threadNb, bool prefixSums, std::string columnDirectory)
+{
+	Profile profile ("buildLattice");
+	delete lattice;
+	lattice = new Lattice (this, implicit, threadNb, prefixSums, columnDirectory);
+	lattice->fixedNormalization = fixedNormalization;
+	if (! lattice->build ()) {
+		std::cerr << "ERROR: Cannot build the out-of-core lattice of '" << name << "' in directory " << columnDirectory << std::endl;
+		delete lattice;
+		lattice = NULL;
+		return false;
 	}
-	return multiSubsets[id];
+	lattice->computeLoss ();
+	return true;
 }
 
 
 MultiPartition *MultiSet::getMultiPartition (double lambda)
 {
+	if (lattice != NULL) return lattice->getMultiPartition (lambda);
+
+	resultPool.clear ();
+	return buildMultiPartition (lambda);
+}
+
+
+MultiPartition *MultiSet::buildMultiPartition (double lambda)
+{
+	Profile profile ("getMultiPartition");
 	for (MultiSubset *multiSubset : multiSubsets) { multiSubset->cost = std::numeric_limits<double>::quiet_NaN(); }	
-	topMultiSubset->computeCost (lambda);
+	for (MultiSubset *multiSubset : orderedMultiSubsets) { multiSubset->computeCost (lambda); }
 
-	MultiPartition *multiPartition = new MultiPartition (dim);
+	MultiPartition *multiPartition = resultPool.create (dim);
 	std::list<MultiSubset*> subsetQueue;
 	subsetQueue.push_back (topMultiSubset);
 
@@ -469,8 +1674,28 @@ MultiPartition *MultiSet::getMultiPartition (double lambda)
 
 
 
+std::vector<MultiPartition*> MultiSet::getMultiPartition (const std::vector<double> &lambdas)
+{
+	if (lattice != NULL) return lattice->getMultiPartition (lambdas);
+
+	resultPool.clear ();
+	std::vector<MultiPartition*> multiPartitions;
+	for (double lambda : lambdas) { multiPartitions.push_back (buildMultiPartition (lambda)); }
+	return multiPartitions;
+}
+
+
+std::vector<MultiPartition*> MultiSet::getRegularizationPath (double lambdaMin, double lambdaMax)
+{
+	if (lattice == NULL) { std::cerr << "ERROR: The regularization path of '" << name << "' requires a lattice (see buildLattice)" << std::endl; return std::vector<MultiPartition*> (); }
+	return lattice->getRegularizationPath (lambdaMin, lambdaMax);
+}
+
+
+
 std::string MultiSet::toString (bool rec)
 {
+	unmapMultiElements ();
 	std::string str = "";
 
 	if (rec) {
@@ -479,8 +1704,15 @@ std::string MultiSet::toString (bool rec)
 	
 	str += name + " = {\n";
 
+	std::vector<MultiElement*> sortedMultiElements;
+	if (sparse) {
+		sortedMultiElements.reserve (sparseMultiElements.size());
+		for (std::pair<const long,MultiElement*> &it : sparseMultiElements) { sortedMultiElements.push_back (it.second); }
+		std::sort (sortedMultiElements.begin(), sortedMultiElements.end(), [] (MultiElement *a, MultiElement *b) { return a->id < b->id; });
+	}
+	
 	bool first = true;
-	for (MultiElement *multiElement : multiElements) {
+	for (MultiElement *multiElement : (sparse ? sortedMultiElements : multiElements)) {
 		if (! first) { str += ",\n"; }
 		first = false;
 		str += "\t" + multiElement->toString (rec);
@@ -507,7 +1739,7 @@ int MultiSubset::addSubset (Subset *subset)
 }
 
 
-void MultiSubset::getMultiElements (std::list<MultiElement*> &multiElements)
+long MultiSubset::getMultiElements (std::list<MultiElement*> &multiElements)
 {
 	multiElements.clear();	
 
@@ -517,26 +1749,56 @@ void MultiSubset::getMultiElements (std::list<MultiElement*> &multiElements)
 	std::list<Element*>::iterator *elementIterators = new std::list<Element*>::iterator [dim];
 	for (int d = 0; d < dim; d++) elementIterators[d] = elementLists[d].begin();
 
+	long cellNb = 1;
+	for (int d = 0; d < dim; d++) cellNb *= elementLists[d].size();
+
 	bool stop;
 	do {
-		multiElements.push_back (multiSet->getMultiElement (elementIterators));
+		MultiElement *multiElement = multiSet->getMultiElement (elementIterators);
+		if (multiElement != NULL) multiElements.push_back (multiElement);
 
 		stop = true;
 		for (int d = 0; d < dim; d++) {
 			elementIterators[d]++;
-			if (elementIterators[d] != elementLists[d].end()) stop = false;
+			if (elementIterators[d] != elementLists[d].end()) { stop = false; d = dim; }
 			else elementIterators[d] = elementLists[d].begin();
 		}
 	} while (! stop);
 
 	delete [] elementLists;
 	delete [] elementIterators;
+
+	return cellNb;
+}
+
+
+void MultiSubset::buildMultiPartitions ()
+{
+	multiPartitions.clear();
+
+	std::vector<Subset*> buildingSubsets (subsets);
+	for (int d = 0; d < dim; d++) {
+		for (Partition *partition : subsets[d]->partitions) {
+			MultiPartition *multiPartition = multiSet->multiPartitionPool.create (dim);
+			multiPartitions.push_back (multiPartition);
+
+			for (Subset *subset : partition->subsets) {
+				buildingSubsets[d] = subset;
+				multiPartition->addMultiSubset (multiSet->getMultiSubset (buildingSubsets));
+			}
+		}
+
+		buildingSubsets[d] = subsets[d];
+	}
+
+	expanded = true;
 }
 
 
 void MultiSubset::computeLoss ()
 {
-	if (! std::isnan (loss)) return;
+	if (! std::isnan (loss)) { Profile::add (Profile::lossMemoHits, 1); return; }
+	if (! expanded) buildMultiPartitions ();
 
 	sumValue = 0;
 	sumInfo = 0;
@@ -545,6 +1807,7 @@ void MultiSubset::computeLoss ()
 	if (multiPartitions.size() > 0) {
 		for (MultiPartition *multiPartition : multiPartitions) {	
 			for (MultiSubset *multiSubset : multiPartition->multiSubsets) multiSubset->computeLoss();
+			Profile::add (Profile::lossVisits, multiPartition->multiSubsets.size());
 		}
 		for (MultiSubset *multiSubset : multiPartitions.front()->multiSubsets) {
 			sumValue += multiSubset->sumValue;
@@ -553,25 +1816,15 @@ void MultiSubset::computeLoss ()
 		}
 	}
 	
-	else {
-		std::list<MultiElement*> multiElements;
-		getMultiElements (multiElements);
-		for (MultiElement *multiElement : multiElements)
-		{
-			sumValue += multiElement->value;
-			if (multiElement->value > 0) { sumInfo -= multiElement->value * log2 (multiElement->value); }
-			multiElementNb++;
-		}
-	}
+	else { multiSet->aggregate (subsets.data(), sumValue, sumInfo, multiElementNb); }
 
-	loss = sumValue * log2 (multiElementNb) - sumInfo;
-	if (sumValue > 0) { loss -= sumValue * log2 (sumValue); }
+	loss = Lattice::getLoss (sumValue, sumInfo, multiElementNb);
 }
 	
 	
 void MultiSubset::computeCost (double lambda)
 {
-	if (! std::isnan (cost)) return;
+	if (! std::isnan (cost)) { Profile::add (Profile::costMemoHits, 1); return; }
 
 	cost = 1 + lambda * loss;
 	//std::cout << toString() << " " << optimalCost << std::endl;
@@ -583,6 +1836,7 @@ void MultiSubset::computeCost (double lambda)
 			multiSubset->computeCost (lambda);
 			nextCost += multiSubset->cost;
 		}
+		Profile::add (Profile::costVisits, nextMultiPartition->multiSubsets.size());
 		if (nextCost < cost) {
 			cost = nextCost;
 			multiPartition = nextMultiPartition;
@@ -643,6 +1897,3000 @@ std::string MultiPartition::toString (bool rec)
 	str += "}";
 
 	if (rec) str += " -> size = " + std::to_string (size) + " / loss = " + std::to_string (loss) + " / cost = " + std::to_string (cost);
+	if (rec && ! std::isnan (lowerBound)) str += " / lower bound = " + std::to_string (lowerBound);
+	if (rec && ! std::isnan (lambdaMin)) str += " / lambda in [" + std::to_string (lambdaMin) + ", " + std::to_string (lambdaMax) + "]";
 
 	return str;
 }
+
+
+
+
+Lattice::Lattice (MultiSet *vMultiSet, bool vImplicit, int vThreadNb, bool vPrefixSums, std::string vColumnDirectory) : multiSet (vMultiSet), dim (vMultiSet->dim), implicit (vImplicit), threadNb (vThreadNb), prefixSums (vPrefixSums), columnDirectory (vColumnDirectory)
+{
+	if (threadNb <= 0) threadNb = std::max (1, (int) std::thread::hardware_concurrency());
+
+	if (columnDirectory != "") {
+		outOfCore = true;
+		implicit = true;
+		valid = multiElementNb.mapFile (getColumnFile (this, "multiElementNb")) && sumValue.mapFile (getColumnFile (this, "sumValue"))
+			&& sumInfo.mapFile (getColumnFile (this, "sumInfo")) && loss.mapFile (getColumnFile (this, "loss"));
+	}
+
+	solver = new Solver (this, threadNb);
+	valid = valid && solver->valid;
+}
+
+
+Lattice::~Lattice ()
+{
+	stopPool ();
+	delete solver;
+	std::lock_guard<std::mutex> lock (solverMutex);
+	for (Solver *solver : solvers) { solver->lattice = NULL; }
+}
+
+
+bool Lattice::build ()
+{
+	if (! valid) return false;
+
+	for (Set *set : multiSet->sets) {
+		if (! set->windowed) continue;
+		if (prefixSums) { std::cerr << "WARNING: Windowed set '" << set->name << "' ignores prefix sums" << std::endl; }
+		implicit = true;
+		prefixSums = false;
+	}
+
+	strides.assign (dim, 1);
+	multiSubsetNb = 1;
+	for (int d = 0; d < dim; d++) {
+		strides[d] = multiSubsetNb;
+		multiSubsetNb *= multiSet->sets[d]->subsetNb;
+	}
+
+	topId = 0;
+	long childNb = 0;
+	multiPartitionNb = 0;
+	maxPartitionSize = 0;
+	for (int d = 0; d < dim; d++) {
+		Set *set = multiSet->sets[d];
+		set->buildPartitions ();
+		topId += set->getTopId () * strides[d];
+
+		multiPartitionNb += set->partitionNb * (multiSubsetNb / set->subsetNb);
+		childNb += set->partitionSubsetNb * (multiSubsetNb / set->subsetNb);
+		maxPartitionSize = std::max (maxPartitionSize, set->maxPartitionSize);
+	}
+
+	multiElementNb.assign (multiSubsetNb, 0);
+	sumValue.assign (multiSubsetNb, std::numeric_limits<double>::quiet_NaN());
+	sumInfo.assign (multiSubsetNb, std::numeric_limits<double>::quiet_NaN());
+	loss.assign (multiSubsetNb, std::numeric_limits<double>::quiet_NaN());
+	if (loss.size() != multiSubsetNb || sumInfo.size() != multiSubsetNb || sumValue.size() != multiSubsetNb || multiElementNb.size() != multiSubsetNb) { valid = false; return false; }
+
+	multiPartitionOffsets.clear ();
+	multiSubsetOffsets.clear ();
+	multiSubsetIds.clear ();
+
+	streaming = outOfCore;
+	for (int d = 0; d < dim && streaming; d++) {
+		Set *set = multiSet->sets[d];
+		std::vector<long> subsetIds (set->maxPartitionSize);
+		for (int s = 0; s < set->subsetNb && streaming; s++) {
+			for (int p = 0; p < set->getPartitionNb (s) && streaming; p++) {
+				int size = set->getPartitionSubsets (s, p, subsetIds.data());
+				for (int c = 0; c < size; c++) { if (subsetIds[c] >= s) streaming = false; }
+			}
+		}
+		if (! streaming) { std::cerr << "WARNING: Subsets of set '" << set->name << "' are not numbered after their children, the out-of-core lattice is swept by levels" << std::endl; }
+	}
+
+	if (! streaming) buildOrder ();
+	if (prefixSums) buildPrefixSums ();
+	if (implicit) return true;
+
+	multiPartitionOffsets.reserve (multiSubsetNb + 1);
+	multiSubsetOffsets.reserve (multiPartitionNb + 1);
+	multiSubsetIds.reserve (childNb);
+
+	std::vector<int> subsetIds (dim, 0);
+	std::vector<long> nextSubsetIds (maxPartitionSize);
+	for (long id = 0; id < multiSubsetNb; id++) {
+		multiPartitionOffsets.push_back (multiSubsetOffsets.size());
+
+		for (int d = 0; d < dim; d++) {
+			Set *set = multiSet->sets[d];
+			int partitionNb = set->getPartitionNb (subsetIds[d]);
+			for (int p = 0; p < partitionNb; p++) {
+				multiSubsetOffsets.push_back (multiSubsetIds.size());
+				int size = set->getPartitionSubsets (subsetIds[d], p, nextSubsetIds.data());
+				for (int c = 0; c < size; c++) { multiSubsetIds.push_back (id + (nextSubsetIds[c] - subsetIds[d]) * strides[d]); }
+			}
+		}
+
+		for (int d = 0; d < dim; d++) {
+			if (++subsetIds[d] < multiSet->sets[d]->subsetNb) break;
+			subsetIds[d] = 0;
+		}
+	}
+	
+	multiPartitionOffsets.push_back (multiSubsetOffsets.size());
+	multiSubsetOffsets.push_back (multiSubsetIds.size());
+	return true;
+}
+
+
+void Lattice::buildOrder ()
+{
+	levelNb = 1;
+	std::vector<std::vector<int>> heights (dim);
+	for (int d = 0; d < dim; d++) {
+		Set *set = multiSet->sets[d];
+		heights[d].resize (set->subsetNb);
+		for (int s = 0; s < set->subsetNb; s++) { heights[d][s] = set->getHeight (s); }
+		levelNb += *std::max_element (heights[d].begin(), heights[d].end());
+	}
+
+	std::vector<int> levels (multiSubsetNb);
+	std::vector<int> subsetIds (dim, 0);
+	int level = 0;
+	for (int d = 0; d < dim; d++) { level += heights[d][0]; }
+
+	for (long id = 0; id < multiSubsetNb; id++) {
+		levels[id] = level;
+		for (int d = 0; d < dim; d++) {
+			level -= heights[d][subsetIds[d]];
+			if (++subsetIds[d] < (int) heights[d].size()) { level += heights[d][subsetIds[d]]; break; }
+			subsetIds[d] = 0;
+			level += heights[d][0];
+		}
+	}
+
+	levelOffsets.assign (levelNb + 1, 0);
+	for (long id = 0; id < multiSubsetNb; id++) { levelOffsets[levels[id] + 1]++; }
+	for (int l = 0; l < levelNb; l++) { levelOffsets[l+1] += levelOffsets[l]; }
+
+	std::vector<long> positions (levelOffsets.begin(), levelOffsets.end() - 1);
+	order.resize (multiSubsetNb);
+	for (long id = 0; id < multiSubsetNb; id++) { order[positions[levels[id]]++] = id; }
+}
+
+
+void Lattice::buildPrefixSums ()
+{
+	for (Set *set : multiSet->sets) {
+		for (int s = 0; s < set->subsetNb; s++) {
+			if (set->isContiguous (s)) continue;
+			std::cerr << "WARNING: Subset '" << set->getSubset (s)->name << "' of set '" << set->name << "' is not an interval, prefix sums cannot be used" << std::endl;
+			prefixSums = false;
+			return;
+		}
+	}
+
+	long size = 1;
+	prefixStrides.assign (dim, 1);
+	for (int d = 0; d < dim; d++) {
+		prefixStrides[d] = size;
+		size *= multiSet->sets[d]->elementNb + 1;
+	}
+
+	prefixValues.assign (size, 0);
+	prefixInfos.assign (size, 0);
+
+	auto addMultiElement = [this] (MultiElement *multiElement) {
+		if (multiElement->value == 0) return;
+		long index = 0;
+		for (int d = 0; d < dim; d++) { index += (multiElement->elements[d]->id + 1) * prefixStrides[d]; }
+		prefixValues[index] += multiElement->value;
+		if (multiElement->value > 0) { prefixInfos[index] += Entropy::xlog2x (multiElement->value); }
+	};
+
+	if (multiSet->sparse) { for (std::pair<const long,MultiElement*> &it : multiSet->sparseMultiElements) addMultiElement (it.second); }
+	else { for (MultiElement *multiElement : multiSet->multiElements) addMultiElement (multiElement); }
+
+	for (int d = 0; d < dim; d++) {
+		long stride = prefixStrides[d];
+		long width = multiSet->sets[d]->elementNb + 1;
+		for (long index = 0; index < size; index++) {
+			if ((index / stride) % width == 0) continue;
+			prefixValues[index] += prefixValues[index - stride];
+			prefixInfos[index] += prefixInfos[index - stride];
+		}
+	}
+}
+
+
+void Lattice::buildActiveOrder ()
+{
+	std::lock_guard<std::mutex> lock (activeMutex);
+	if (! activeStale) return;
+	if (streaming) { activeStale = false; return; }
+
+	activeOrder.clear ();
+	activeLevelOffsets.assign (levelNb + 1, 0);
+	for (int l = 0; l < levelNb; l++) {
+		for (long i = levelOffsets[l]; i < levelOffsets[l+1]; i++) { if (loss[order[i]] != 0) activeOrder.push_back (order[i]); }
+		activeLevelOffsets[l+1] = activeOrder.size();
+	}
+
+	activeVersion++;
+	activeStale = false;
+}
+
+
+void Lattice::sweep (const std::function<void (const long *order, long nb, long *ids)> &function, bool levels, int workerNb, bool active)
+{
+	if (workerNb <= 0) workerNb = threadNb;
+
+	if (streaming) {
+		int k = 0;
+		while (k < dim - 1 && strides[k] < 4096) { k++; }
+		long blockSize = strides[k];
+		std::map<int,std::vector<long>> blocksByHeight;
+		for (long blockBegin = 0; blockBegin < multiSubsetNb; blockBegin += blockSize) {
+			int height = 0;
+			for (int d = k; d < dim && levels; d++) { height += multiSet->sets[d]->getHeight (getSubsetId (blockBegin, d)); }
+			blocksByHeight[height].push_back (blockBegin);
+		}
+
+		std::vector<std::vector<long>> blocks;
+		for (std::pair<const int,std::vector<long>> &it : blocksByHeight) { blocks.push_back (it.second); }
+		std::unique_ptr<std::atomic<long>[]> nextBlocks (new std::atomic<long> [blocks.size()]);
+		for (unsigned int l = 0; l < blocks.size(); l++) { nextBlocks[l] = 0; }
+
+		Barrier barrier (workerNb);
+		auto worker = [&] () {
+			std::vector<long> ids (maxPartitionSize);
+			std::vector<long> chunk (4096);
+			for (unsigned int l = 0; l < blocks.size(); l++) {
+				while (true) {
+					long b = nextBlocks[l].fetch_add (1);
+					if (b >= (long) blocks[l].size()) break;
+					long blockBegin = blocks[l][b];
+					for (long begin = blockBegin; begin < blockBegin + blockSize; begin += chunk.size()) {
+						long nb = std::min ((long) chunk.size(), blockBegin + blockSize - begin);
+						for (long i = 0; i < nb; i++) { chunk[i] = begin + i; }
+						function (chunk.data(), nb, ids.data());
+					}
+				}
+				barrier.wait ();
+			}
+		};
+
+		runPool (worker, workerNb);
+		return;
+	}
+
+	const long *ids = active ? activeOrder.data() : order.data();
+	long nb = active ? (long) activeOrder.size() : multiSubsetNb;
+	if (workerNb <= 1) {
+		std::vector<long> childIds (maxPartitionSize);
+		function (ids, nb, childIds.data());
+		return;
+	}
+
+	long flatOffsets [2] = {0, nb};
+	const long *offsets = levels ? (active ? activeLevelOffsets.data() : levelOffsets.data()) : flatOffsets;
+	int levelNb = levels ? this->levelNb : 1;
+
+	std::unique_ptr<std::atomic<long>[]> nextPositions (new std::atomic<long> [levelNb]);
+	for (int l = 0; l < levelNb; l++) { nextPositions[l] = offsets[l]; }
+
+	Barrier barrier (workerNb);
+	auto worker = [&] () {
+		std::vector<long> childIds (maxPartitionSize);
+		for (int l = 0; l < levelNb; l++) {
+			long levelEnd = offsets[l+1];
+			long chunkSize = std::max (1L, std::min (1024L, (levelEnd - offsets[l]) / (8L * workerNb)));
+			while (true) {
+				long begin = nextPositions[l].fetch_add (chunkSize);
+				if (begin >= levelEnd) break;
+				function (ids + begin, std::min (chunkSize, levelEnd - begin), childIds.data());
+			}
+			barrier.wait ();
+		}
+	};
+
+	runPool (worker, workerNb);
+}
+
+
+void Lattice::runPool (const std::function<void ()> &worker, int workerNb)
+{
+	if (workerNb <= 1) { worker (); return; }
+
+	std::lock_guard<std::mutex> lock (poolMutex);
+	if ((int) poolThreads.size() < workerNb - 1) {
+		stopPool ();
+		poolBarrier = new Barrier (workerNb);
+		for (int t = 0; t < workerNb - 1; t++) {
+			poolThreads.push_back (std::thread ([this, t] () {
+				while (true) {
+					poolBarrier->wait ();
+					if (poolTask == NULL) return;
+					if (t < poolWorkerNb - 1) { poolTask (); }
+					poolBarrier->wait ();
+				}
+			}));
+		}
+	}
+
+	poolTask = worker;
+	poolWorkerNb = workerNb;
+	poolBarrier->wait ();
+	worker ();
+	poolBarrier->wait ();
+	poolTask = NULL;
+}
+
+
+void Lattice::stopPool ()
+{
+	if (poolBarrier == NULL) return;
+	poolTask = NULL;
+	poolBarrier->wait ();
+	for (std::thread &thread : poolThreads) { thread.join(); }
+	poolThreads.clear ();
+	delete poolBarrier;
+	poolBarrier = NULL;
+}
+
+
+std::string Lattice::getColumnFile (const void *owner, std::string name)
+{
+	return columnDirectory + "/" + std::to_string (getpid ()) + "-" + std::to_string ((unsigned long) owner) + "-" + name + ".column";
+}
+
+
+long Lattice::getActiveNb () { return streaming ? multiSubsetNb : activeOrder.size(); }
+
+
+
+Batch::Batch (Lattice *vLattice, int vThreadNb) : lattice (vLattice), solver (vLattice, vThreadNb) {}
+
+
+int Batch::addDataset (std::string filename, int threadNb)
+{
+	std::vector<std::pair<long,double>> cells;
+	if (! lattice->multiSet->readMultiElements (filename, cells, threadNb)) return -1;
+	return addDataset (cells);
+}
+
+
+int Batch::addDataset (const std::vector<std::pair<long,double>> &cells)
+{
+	datasets.push_back (cells);
+	return datasetNb++;
+}
+
+
+void Batch::computeLoss ()
+{
+	laneNb = (datasetNb + 7) / 8 * 8;
+
+	cellRows.clear ();
+	cellValues.clear ();
+	for (int b = 0; b < datasetNb; b++) {
+		for (std::pair<long,double> &cell : datasets[b]) {
+			std::pair<std::unordered_map<long,long>::iterator,bool> it = cellRows.insert (std::pair<long,long> (cell.first, cellRows.size()));
+			if (it.second) { cellValues.resize (cellValues.size() + laneNb, 0); }
+			cellValues[it.first->second * laneNb + b] = cell.second;
+		}
+	}
+
+	sumValues.assign (lattice->multiSubsetNb * laneNb, 0);
+	sumInfos.assign (lattice->multiSubsetNb * laneNb, 0);
+	losses.assign (lattice->multiSubsetNb * laneNb, 0);
+	lattice->sweep ([this] (const long *order, long nb, long *ids) { for (long i = 0; i < nb; i++) computeLoss (order[i], ids); }, true, solver.threadNb);
+
+	const double *totals = &sumValues[lattice->topId * laneNb];
+	for (long id = 0; id < lattice->multiSubsetNb; id++) {
+		for (int l = 0; l < datasetNb; l++) { if (totals[l] != 0) losses[id * laneNb + l] /= totals[l]; }
+	}
+}
+
+
+void Batch::computeLoss (long id, long *ids)
+{
+	double *values = &sumValues[id * laneNb];
+	double *infos = &sumInfos[id * laneNb];
+
+	int size = (lattice->getMultiPartitionNb (id) > 0) ? lattice->getMultiSubsetIds (id, 0, ids) : 0;
+	for (int c = 0; c < size; c++) {
+		const double *childValues = &sumValues[ids[c] * laneNb];
+		const double *childInfos = &sumInfos[ids[c] * laneNb];
+		for (int l = 0; l < laneNb; l++) {
+			values[l] += childValues[l];
+			infos[l] += childInfos[l];
+		}
+	}
+
+	if (size == 0) {
+		MultiSet *multiSet = lattice->multiSet;
+		long cellId = 0;
+		for (int d = 0; d < lattice->dim; d++) {
+			int elementId = multiSet->sets[d]->getElementId (lattice->getSubsetId (id, d));
+			if (elementId < 0) { std::cerr << "ERROR: Batch compression requires every multi-subset without partition to be a single cell" << std::endl; return; }
+			cellId += elementId * multiSet->elementStrides[d];
+		}
+
+		std::unordered_map<long,long>::iterator it = cellRows.find (cellId);
+		if (it != cellRows.end()) {
+			const double *cellValue = &cellValues[it->second * laneNb];
+			Entropy::xlog2x (cellValue, infos, laneNb);
+			for (int l = 0; l < laneNb; l++) {
+				values[l] = cellValue[l];
+				infos[l] = - infos[l];
+			}
+		}
+	}
+
+	double *idLosses = &losses[id * laneNb];
+	double elementLog = Entropy::log2n (lattice->multiElementNb[id]);
+	Entropy::xlog2x (values, idLosses, laneNb);
+	for (int l = 0; l < laneNb; l++) {
+		idLosses[l] = values[l] * elementLog - infos[l] - idLosses[l];
+		if (idLosses[l] < std::abs (values[l]) * 1e-12) { idLosses[l] = 0; }
+	}
+}
+
+
+std::vector<MultiPartition*> Batch::getMultiPartition (double lambda)
+{
+	resultPool.clear ();
+	viewPool.clear ();
+
+	solver.laneLosses = losses.data();
+	solver.computeCosts (std::vector<double> (datasetNb, lambda));
+	solver.laneLosses = NULL;
+
+	std::vector<MultiPartition*> results;
+	std::vector<long> ids (lattice->maxPartitionSize);
+	for (int l = 0; l < datasetNb; l++) {
+		MultiPartition *result = resultPool.create (lattice->dim);
+		std::list<long> idQueue;
+		idQueue.push_back (lattice->topId);
+
+		while (! idQueue.empty()) {
+			long id = idQueue.front();
+			idQueue.pop_front();
+
+			int k = solver.laneMultiPartitions[id * laneNb + l];
+			if (k < 0) {
+				MultiSubset *multiSubset = lattice->getMultiSubset (id, viewPool);
+				multiSubset->sumValue = sumValues[id * laneNb + l];
+				multiSubset->sumInfo = sumInfos[id * laneNb + l];
+				multiSubset->loss = losses[id * laneNb + l];
+				multiSubset->cost = solver.laneCosts[id * laneNb + l];
+				result->addMultiSubset (multiSubset);
+			}
+			else {
+				int size = lattice->getMultiSubsetIds (id, k, ids.data());
+				for (int c = 0; c < size; c++) { idQueue.push_back (ids[c]); }
+			}
+		}
+
+		results.push_back (result);
+	}
+
+	return results;
+}
+
+
+
+Anytime::Anytime (MultiSet *vMultiSet, double vTimeBudget, long vNodeBudget) : multiSet (vMultiSet), dim (vMultiSet->dim), timeBudget (vTimeBudget), nodeBudget (vNodeBudget)
+{
+	long multiSubsetNb = 1;
+	for (Set *set : multiSet->sets) {
+		set->buildPartitions ();
+		strides.push_back (multiSubsetNb);
+		topIds.push_back (set->getTopId ());
+		multiSubsetNb *= set->subsetNb;
+		maxPartitionSize = std::max (maxPartitionSize, set->maxPartitionSize);
+	}
+}
+
+
+long Anytime::getNode (long id)
+{
+	std::unordered_map<long,long>::iterator it = nodes.find (id);
+	if (it != nodes.end()) return it->second;
+
+	std::vector<Subset*> subsets (dim);
+	std::vector<long> subsetIds (maxPartitionSize);
+	int minSize = std::numeric_limits<int>::max();
+	for (int d = 0; d < dim; d++) {
+		Set *set = multiSet->sets[d];
+		int subsetId = (id / strides[d]) % set->subsetNb;
+		subsets[d] = set->getSubset (subsetId);
+		for (int p = 0; p < set->getPartitionNb (subsetId); p++) { minSize = std::min (minSize, set->getPartitionSubsets (subsetId, p, subsetIds.data())); }
+	}
+
+	double value, info;
+	long elementNb;
+	multiSet->aggregate (subsets.data(), value, info, elementNb);
+	double loss = Lattice::getLoss (value, info, elementNb);
+
+	long node = ids.size();
+	nodes[id] = node;
+	ids.push_back (id);
+	values.push_back (value);
+	infos.push_back (info);
+	elementNbs.push_back (elementNb);
+	losses.push_back (loss);
+	minSizes.push_back (minSize);
+	partitionBegins.push_back (-1);
+	partitionEnds.push_back (-1);
+	return node;
+}
+
+
+void Anytime::expand (long node)
+{
+	std::vector<long> subsetIds (maxPartitionSize);
+	std::vector<long> children;
+	long id = ids[node];
+	for (int d = 0; d < dim; d++) {
+		Set *set = multiSet->sets[d];
+		int subsetId = (id / strides[d]) % set->subsetNb;
+		for (int p = 0; p < set->getPartitionNb (subsetId); p++) {
+			int size = set->getPartitionSubsets (subsetId, p, subsetIds.data());
+			children.push_back (size);
+			for (int c = 0; c < size; c++) { children.push_back (getNode (id + (subsetIds[c] - subsetId) * strides[d])); }
+		}
+	}
+
+	partitionBegins[node] = partitionNodes.size();
+	partitionNodes.insert (partitionNodes.end(), children.begin(), children.end());
+	partitionEnds[node] = partitionNodes.size();
+}
+
+
+MultiPartition *Anytime::getMultiPartition (double lambda)
+{
+	Profile profile ("getMultiPartition");
+	resultPool.clear ();
+	viewPool.clear ();
+	double begin = Profile::getWallTime ();
+
+	long topId = 0;
+	for (int d = 0; d < dim; d++) { topId += topIds[d] * strides[d]; }
+	long top = getNode (topId);
+	double scale = (values[top] != 0) ? lambda / values[top] : 0;
+
+	auto getCost = [&] (long node) { return 1 + scale * losses[node]; };
+	auto getGap = [&] (long node) { return (minSizes[node] == std::numeric_limits<int>::max()) ? -1 : getCost (node) - minSizes[node]; };
+	long nodeNb = ids.size();
+	auto hasBudget = [&] () { return (nodeBudget <= 0 || (long) ids.size() - nodeNb < nodeBudget) && (timeBudget <= 0 || Profile::getWallTime () - begin < timeBudget); };
+
+	std::list<long> nodeQueue;
+	nodeQueue.push_back (top);
+	while (! nodeQueue.empty() && hasBudget ()) {
+		long node = nodeQueue.front();
+		nodeQueue.pop_front();
+		if (getGap (node) <= 0) continue;
+		if (partitionBegins[node] < 0) expand (node);
+
+		double bestCost = getCost (node);
+		long bestPartition = -1;
+		for (long p = partitionBegins[node]; p < partitionEnds[node]; p += partitionNodes[p] + 1) {
+			double nextCost = 0;
+			for (long c = p + 1; c <= p + partitionNodes[p]; c++) { nextCost += getCost (partitionNodes[c]); }
+			if (nextCost < bestCost) { bestCost = nextCost; bestPartition = p; }
+		}
+		if (bestPartition >= 0) { for (long c = bestPartition + 1; c <= bestPartition + partitionNodes[bestPartition]; c++) nodeQueue.push_back (partitionNodes[c]); }
+	}
+
+	std::priority_queue<std::pair<double,long>> nodeHeap;
+	for (long node = 0; node < (long) ids.size(); node++) { if (partitionBegins[node] < 0 && getGap (node) > 0) nodeHeap.push (std::pair<double,long> (getGap (node), node)); }
+	while (! nodeHeap.empty() && hasBudget ()) {
+		long node = nodeHeap.top().second;
+		nodeHeap.pop();
+		if (partitionBegins[node] >= 0) continue;
+
+		long childNb = ids.size();
+		expand (node);
+		for (long child = childNb; child < (long) ids.size(); child++) { if (getGap (child) > 0) nodeHeap.push (std::pair<double,long> (getGap (child), child)); }
+	}
+
+	std::vector<double> costs (ids.size(), -1);
+	std::vector<double> bounds (ids.size(), -1);
+	std::vector<long> choices (ids.size(), -1);
+	std::function<void (long)> solve = [&] (long node) {
+		if (costs[node] >= 0) return;
+		costs[node] = getCost (node);
+		bounds[node] = (partitionBegins[node] < 0) ? std::min (costs[node], (double) minSizes[node]) : costs[node];
+		if (getGap (node) <= 0) { bounds[node] = costs[node]; return; }
+
+		for (long p = partitionBegins[node]; p >= 0 && p < partitionEnds[node]; p += partitionNodes[p] + 1) {
+			double nextCost = 0, nextBound = 0;
+			for (long c = p + 1; c <= p + partitionNodes[p]; c++) {
+				solve (partitionNodes[c]);
+				nextCost += costs[partitionNodes[c]];
+				nextBound += bounds[partitionNodes[c]];
+			}
+			if (nextCost < costs[node]) { costs[node] = nextCost; choices[node] = p; }
+			bounds[node] = std::min (bounds[node], nextBound);
+		}
+	};
+	solve (top);
+	cost = costs[top];
+	lowerBound = bounds[top];
+	exact = nodeHeap.empty() || lowerBound >= cost;
+
+	MultiPartition *result = resultPool.create (dim);
+	nodeQueue.push_back (top);
+	while (! nodeQueue.empty()) {
+		long node = nodeQueue.front();
+		nodeQueue.pop_front();
+
+		if (choices[node] >= 0) {
+			long p = choices[node];
+			for (long c = p + 1; c <= p + partitionNodes[p]; c++) { nodeQueue.push_back (partitionNodes[c]); }
+			continue;
+		}
+
+		MultiSubset *multiSubset = viewPool.create (multiSet);
+		multiSubset->id = ids[node];
+		multiSubset->top = true;
+		multiSubset->bot = true;
+		for (int d = 0; d < dim; d++) {
+			Subset *subset = multiSet->sets[d]->getSubset ((ids[node] / strides[d]) % multiSet->sets[d]->subsetNb);
+			multiSubset->addSubset (subset);
+			multiSubset->top = multiSubset->top && subset->top;
+			multiSubset->bot = multiSubset->bot && subset->bot;
+		}
+		multiSubset->multiElementNb = elementNbs[node];
+		multiSubset->sumValue = values[node];
+		multiSubset->sumInfo = infos[node];
+		multiSubset->loss = (values[top] != 0) ? losses[node] / values[top] : 0;
+		multiSubset->cost = getCost (node);
+		result->addMultiSubset (multiSubset);
+	}
+
+	result->lowerBound = lowerBound;
+	return result;
+}
+
+
+
+template <int D>
+LatticeKernel<D>::LatticeKernel (Lattice *vLattice) : lattice (vLattice), dim (vLattice->dim)
+{
+	for (int d = 0; d < getDim (); d++) {
+		sets[d] = lattice->multiSet->sets[d];
+		strides[d] = lattice->strides[d];
+		subsetNbs[d] = sets[d]->subsetNb;
+	}
+}
+
+
+template <int D>
+void LatticeKernel<D>::getSubsetIds (long id, std::array<int,capacity> &subsetIds)
+{
+	for (int d = 0; d < getDim (); d++) { subsetIds[d] = (id / strides[d]) % subsetNbs[d]; }
+}
+
+
+template <int D>
+bool LatticeKernel<D>::computeEmptyLoss (long id, const std::array<int,capacity> &subsetIds)
+{
+	if (lattice->emptySubsets.empty()) return false;
+
+	bool empty = false;
+	long elementNb = 1;
+	for (int d = 0; d < getDim (); d++) {
+		if (lattice->emptySubsets[d][subsetIds[d]]) { empty = true; }
+		elementNb *= lattice->subsetSizes[d][subsetIds[d]];
+	}
+	if (! empty) return false;
+
+	lattice->sumValue[id] = 0;
+	lattice->sumInfo[id] = 0;
+	lattice->multiElementNb[id] = elementNb;
+	lattice->loss[id] = 0;
+	return true;
+}
+
+
+template <int D>
+void LatticeKernel<D>::computeLoss (long id, long *ids, Counts &counts)
+{
+	std::array<int,capacity> subsetIds {};
+	getSubsetIds (id, subsetIds);
+	if (computeEmptyLoss (id, subsetIds)) { counts.prunes++; return; }
+
+	double value = 0;
+	double info = 0;
+	long elementNb = 0;
+
+	int size = 0;
+	if (! lattice->implicit) { if (lattice->getMultiPartitionNb (id) > 0) size = lattice->getMultiSubsetIds (id, 0, ids); }
+	else {
+		for (int d = 0; d < getDim () && size == 0; d++) {
+			if (sets[d]->getPartitionNb (subsetIds[d]) == 0) continue;
+			size = sets[d]->getPartitionSubsets (subsetIds[d], 0, ids);
+			for (int c = 0; c < size; c++) { ids[c] = id + (ids[c] - subsetIds[d]) * strides[d]; }
+		}
+	}
+
+	if (size > 0) {
+		counts.visits += size;
+		for (int c = 0; c < size; c++) {
+			value += lattice->sumValue[ids[c]];
+			info += lattice->sumInfo[ids[c]];
+			elementNb += lattice->multiElementNb[ids[c]];
+		}
+	}
+
+	else {
+		MultiSet *multiSet = lattice->multiSet;
+		long cellId = 0;
+		bool bot = true;
+		for (int d = 0; d < getDim () && bot; d++) {
+			int elementId = sets[d]->getElementId (subsetIds[d]);
+			if (elementId >= 0) { cellId += elementId * multiSet->elementStrides[d]; }
+			else { bot = false; }
+		}
+
+		if (bot) {
+			value = multiSet->getValue (cellId);
+			if (value > 0) { info = - Entropy::xlog2x (value); }
+			elementNb = 1;
+		}
+
+		else {
+			std::array<Subset*,capacity> subsets;
+			for (int d = 0; d < getDim (); d++) { subsets[d] = sets[d]->getSubset (subsetIds[d]); }
+			multiSet->aggregate (subsets.data(), value, info, elementNb);
+		}
+	}
+
+	lattice->sumValue[id] = value;
+	lattice->sumInfo[id] = info;
+	lattice->multiElementNb[id] = elementNb;
+	lattice->loss[id] = lattice->getLoss (value, info, elementNb);
+}
+
+
+template <int D>
+void LatticeKernel<D>::computePrefixLoss (long id, Counts &counts)
+{
+	std::array<int,capacity> subsetIds {};
+	getSubsetIds (id, subsetIds);
+	if (computeEmptyLoss (id, subsetIds)) { counts.prunes++; return; }
+
+	long elementNb = 1;
+	std::array<long,capacity> begins;
+	std::array<long,capacity> ends;
+	for (int d = 0; d < getDim (); d++) {
+		int begin, end;
+		sets[d]->getElementRange (subsetIds[d], begin, end);
+		begins[d] = begin * lattice->prefixStrides[d];
+		ends[d] = end * lattice->prefixStrides[d];
+		elementNb *= end - begin;
+	}
+
+	double value = 0;
+	double info = 0;
+	for (long mask = 0; mask < (1L << getDim ()); mask++) {
+		long index = 0;
+		int sign = (getDim () % 2 == 0) ? 1 : -1;
+		for (int d = 0; d < getDim (); d++) {
+			if (mask & (1L << d)) { index += ends[d]; sign = -sign; }
+			else { index += begins[d]; }
+		}
+		value += sign * lattice->prefixValues[index];
+		info -= sign * lattice->prefixInfos[index];
+	}
+
+	lattice->sumValue[id] = value;
+	lattice->sumInfo[id] = info;
+	lattice->multiElementNb[id] = elementNb;
+	lattice->loss[id] = lattice->getLoss (value, info, elementNb);
+}
+
+
+template <int D>
+void LatticeKernel<D>::computeCost (Solver *solver, long id, double lambda, long *ids, Counts &counts)
+{
+	double *cost = solver->cost.data();
+	double bestCost = 1 + lambda * lattice->loss[id];
+	int bestMultiPartition = -1;
+	if (solver->splitCosts != NULL && solver->splitCosts[id] < bestCost) {
+		bestCost = solver->splitCosts[id];
+		bestMultiPartition = -2;
+	}
+
+	auto tryMultiPartition = [&] (int k, int size) {
+		if (size >= bestCost) { counts.prunes++; return; }
+
+		double nextCost = 0;
+		int c = 0;
+		while (c < size) {
+			nextCost += cost[ids[c++]];
+			if (nextCost + (size - c - 1) >= bestCost) break;
+		}
+		counts.visits += c;
+		if (c < size) { counts.prunes++; }
+		else if (nextCost < bestCost) {
+			bestCost = nextCost;
+			bestMultiPartition = k;
+		}
+	};
+
+	if (lattice->loss[id] != 0 && ! lattice->implicit) {
+		int multiPartitionNb = lattice->getMultiPartitionNb (id);
+		for (int k = 0; k < multiPartitionNb; k++) { tryMultiPartition (k, lattice->getMultiSubsetIds (id, k, ids)); }
+	}
+
+	else if (lattice->loss[id] != 0) {
+		std::array<int,capacity> subsetIds {};
+		getSubsetIds (id, subsetIds);
+
+		int k = 0;
+		for (int d = 0; d < getDim (); d++) {
+			int partitionNb = sets[d]->getPartitionNb (subsetIds[d]);
+			for (int p = 0; p < partitionNb; p++, k++) {
+				int size = sets[d]->getPartitionSubsets (subsetIds[d], p, ids);
+				for (int c = 0; c < size; c++) { ids[c] = id + (ids[c] - subsetIds[d]) * strides[d]; }
+				tryMultiPartition (k, size);
+			}
+		}
+	}
+
+	cost[id] = bestCost;
+	solver->multiPartition[id] = bestMultiPartition;
+}
+
+
+
+template <typename Function>
+void Lattice::withKernel (Function function)
+{
+	switch (dim) {
+	case 2: function (LatticeKernel<2> (this)); return;
+	case 3: function (LatticeKernel<3> (this)); return;
+	case 4: function (LatticeKernel<4> (this)); return;
+	case 5: function (LatticeKernel<5> (this)); return;
+	case 6: function (LatticeKernel<6> (this)); return;
+	default: function (LatticeKernel<0> (this)); return;
+	}
+}
+
+
+void Lattice::computeLoss ()
+{
+	Profile profile ("computeLoss");
+	findEmptySubsets ();
+	withKernel ([this] (auto kernel) {
+		if (prefixSums) {
+			sweep ([&kernel] (const long *order, long nb, long *ids) {
+				Counts counts;
+				for (long i = 0; i < nb; i++) kernel.computePrefixLoss (order[i], counts);
+				Profile::addLoss (counts);
+			}, false);
+		}
+		else {
+			sweep ([&kernel] (const long *order, long nb, long *ids) {
+				Counts counts;
+				for (long i = 0; i < nb; i++) kernel.computeLoss (order[i], ids, counts);
+				Profile::addLoss (counts);
+			});
+		}
+	});
+
+	emptySubsets.clear ();
+	subsetSizes.clear ();
+
+	normalization = sumValue[topId];
+	for (long id = 0; id < multiSubsetNb; id++) { loss[id] /= normalization; }
+
+	activeStale = true;
+	std::lock_guard<std::mutex> lock (solverMutex);
+	for (Solver *solver : solvers) { solver->reset (); }
+}
+
+
+void Lattice::computeLoss (const std::vector<double> &values, const std::vector<double> &infos, const std::vector<long> &elementNbs)
+{
+	Profile profile ("computeLoss");
+	for (long id = 0; id < multiSubsetNb; id++) {
+		sumValue[id] = values[id];
+		sumInfo[id] = infos[id];
+		multiElementNb[id] = elementNbs[id];
+		loss[id] = getLoss (values[id], infos[id], elementNbs[id]);
+	}
+
+	normalization = sumValue[topId];
+	for (long id = 0; id < multiSubsetNb; id++) { loss[id] /= normalization; }
+
+	activeStale = true;
+	std::lock_guard<std::mutex> lock (solverMutex);
+	for (Solver *solver : solvers) { solver->reset (); }
+}
+
+
+void Lattice::findEmptySubsets ()
+{
+	std::vector<std::vector<double>> masses (dim);
+	for (int d = 0; d < dim; d++) { masses[d].assign (multiSet->sets[d]->elementNb, 0); }
+
+	auto addCell = [this, &masses] (long cellId, double value) {
+		if (value == 0) return;
+		for (int d = 0; d < dim; d++) { masses[d][(cellId / multiSet->elementStrides[d]) % multiSet->sets[d]->elementNb] += std::abs (value); }
+	};
+
+	if (! multiSet->cellIds.empty()) { for (long i = 0; i < (long) multiSet->cellIds.size(); i++) addCell (multiSet->cellIds[i], multiSet->cellValues[i]); }
+	else if (multiSet->sparse) { for (std::pair<const long,MultiElement*> &it : multiSet->sparseMultiElements) addCell (it.first, it.second->value); }
+	else { for (MultiElement *multiElement : multiSet->multiElements) addCell (multiElement->id, multiElement->value); }
+
+	emptySubsets.resize (dim);
+	subsetSizes.resize (dim);
+	for (int d = 0; d < dim; d++) {
+		Set *set = multiSet->sets[d];
+		std::vector<int> nonEmptyNbs (set->elementNb + 1, 0);
+		for (int e = 0; e < set->elementNb; e++) { nonEmptyNbs[e+1] = nonEmptyNbs[e] + (masses[d][e] != 0); }
+
+		emptySubsets[d].assign (set->subsetNb, true);
+		subsetSizes[d].assign (set->subsetNb, 0);
+		for (int s = 0; s < set->subsetNb; s++) {
+			if (set->isContiguous (s)) {
+				int begin, end;
+				set->getElementRange (s, begin, end);
+				int nonEmptyNb = nonEmptyNbs[std::min (end, set->elementNb)] - nonEmptyNbs[begin];
+				if (end > set->elementNb) { nonEmptyNb += nonEmptyNbs[end - set->elementNb]; }
+				subsetSizes[d][s] = end - begin;
+				emptySubsets[d][s] = (nonEmptyNb == 0);
+				continue;
+			}
+
+			std::list<Element*> subsetElements;
+			set->getSubset (s)->getElements (subsetElements);
+			subsetSizes[d][s] = subsetElements.size();
+			for (Element *element : subsetElements) { if (masses[d][element->id] != 0) { emptySubsets[d][s] = false; } }
+		}
+	}
+}
+
+
+double Lattice::getLoss (double value, double info, long elementNb)
+{
+	double loss = value * Entropy::log2n (elementNb) - info;
+	if (value > 0) { loss -= Entropy::xlog2x (value); }
+	if (loss < std::abs (value) * 1e-12) { loss = 0; }
+	return loss;
+}
+
+
+double Lattice::getLossScale () { return fixedNormalization ? 1 : normalization / sumValue[topId]; }
+
+
+void Lattice::updateValue (long cellId, double oldValue, double newValue)
+{
+	if (prefixSums) {
+		prefixSums = false;
+		prefixValues.clear ();
+		prefixInfos.clear ();
+	}
+
+	double deltaValue = newValue - oldValue;
+	double deltaInfo = 0;
+	if (oldValue > 0) { deltaInfo += Entropy::xlog2x (oldValue); }
+	if (newValue > 0) { deltaInfo -= Entropy::xlog2x (newValue); }
+
+	std::vector<std::vector<int>> subsetIds (dim);
+	for (int d = 0; d < dim; d++) { multiSet->sets[d]->getContainingSubsets ((cellId / multiSet->elementStrides[d]) % multiSet->sets[d]->elementNb, subsetIds[d]); }
+
+	std::lock_guard<std::mutex> lock (solverMutex);
+	std::vector<int> positions (dim, 0);
+	while (true) {
+		long id = 0;
+		for (int d = 0; d < dim; d++) { id += subsetIds[d][positions[d]] * strides[d]; }
+
+		sumValue[id] += deltaValue;
+		sumInfo[id] += deltaInfo;
+		if (loss[id] == 0) { activeStale = true; }
+		loss[id] = getLoss (sumValue[id], sumInfo[id], multiElementNb[id]) / normalization;
+		for (Solver *solver : solvers) { solver->markDirty (id); }
+
+		int d = 0;
+		while (d < dim && ++positions[d] == (int) subsetIds[d].size()) { positions[d++] = 0; }
+		if (d == dim) break;
+	}
+}
+
+
+void Lattice::slideWindow (int d)
+{
+	Set *set = multiSet->sets[d];
+	long restNb = multiSubsetNb / set->subsetNb;
+
+	std::vector<std::pair<int,long>> levelIds;
+	levelIds.reserve (set->elementNb * restNb);
+	for (int length = 1; length <= set->elementNb; length++) {
+		int subsetId = set->getIntervalId (set->elementNb - length, length);
+		for (long rest = 0; rest < restNb; rest++) {
+			long id = rest % strides[d] + subsetId * strides[d] + rest / strides[d] * strides[d] * set->subsetNb;
+			int level = 0;
+			for (int c = 0; c < dim; c++) { level += multiSet->sets[c]->getHeight (getSubsetId (id, c)); }
+			levelIds.push_back (std::pair<int,long> (level, id));
+		}
+	}
+	std::sort (levelIds.begin(), levelIds.end());
+
+	std::vector<long> ids (maxPartitionSize);
+	Counts counts;
+	std::lock_guard<std::mutex> lock (solverMutex);
+	withKernel ([&] (auto kernel) {
+		for (std::pair<int,long> &levelId : levelIds) {
+			long id = levelId.second;
+			if (loss[id] == 0) { activeStale = true; }
+			kernel.computeLoss (id, ids.data(), counts);
+			loss[id] /= normalization;
+			for (Solver *solver : solvers) { solver->markDirty (id); }
+		}
+	});
+	Profile::addLoss (counts);
+}
+
+
+MultiPartition *Lattice::getMultiPartition (double lambda) { return solver->getMultiPartition (lambda); }
+
+std::vector<MultiPartition*> Lattice::getMultiPartition (const std::vector<double> &lambdas) { return solver->getMultiPartition (lambdas); }
+
+std::vector<MultiPartition*> Lattice::getRegularizationPath (double lambdaMin, double lambdaMax) { return solver->getRegularizationPath (lambdaMin, lambdaMax); }
+
+
+
+Solver::Solver (Lattice *vLattice, int vThreadNb) : lattice (vLattice), threadNb (vThreadNb) 
+{
+	if (lattice == NULL) return;
+	if (lattice->outOfCore) {
+		valid = cost.mapFile (lattice->getColumnFile (this, "cost")) && multiPartition.mapFile (lattice->getColumnFile (this, "multiPartition"))
+			&& laneCosts.mapFile (lattice->getColumnFile (this, "laneCosts")) && laneMultiPartitions.mapFile (lattice->getColumnFile (this, "laneMultiPartitions"))
+			&& segmentBegins.mapFile (lattice->getColumnFile (this, "segmentBegins")) && segmentEnds.mapFile (lattice->getColumnFile (this, "segmentEnds"));
+	}
+	std::lock_guard<std::mutex> lock (lattice->solverMutex);
+	lattice->solvers.push_back (this);
+}
+
+
+Solver::~Solver ()
+{
+	if (lattice == NULL) return;
+	std::lock_guard<std::mutex> lock (lattice->solverMutex);
+	lattice->solvers.remove (this);
+}
+
+
+void Solver::reset ()
+{
+	costLambda = std::numeric_limits<double>::quiet_NaN();
+	activeVersion = -1;
+	laneActiveVersion = -1;
+	for (long id : dirtyIds) { dirty[id] = false; }
+	dirtyIds.clear ();
+}
+
+
+void Solver::releaseResults ()
+{
+	resultPool.clear ();
+	viewPool.clear ();
+}
+
+
+void Solver::markDirty (long id)
+{
+	if (std::isnan (costLambda)) return;
+	if ((long) dirty.size() != lattice->multiSubsetNb) { dirty.assign (lattice->multiSubsetNb, false); }
+	if (! dirty[id]) { dirty[id] = true; dirtyIds.push_back (id); }
+}
+
+
+void Solver::computeCost (double lambda)
+{
+	lambda *= lattice->getLossScale ();
+
+	if ((long) cost.size() != lattice->multiSubsetNb) {
+		cost.resize (lattice->multiSubsetNb);
+		multiPartition.resize (lattice->multiSubsetNb);
+		reset ();
+	}
+
+	Profile profile ("computeCost");
+	if (lambda != costLambda) {
+		if (lattice->activeStale) lattice->buildActiveOrder ();
+		if (activeVersion != lattice->activeVersion) {
+			std::fill (cost.begin(), cost.end(), 1);
+			std::fill (multiPartition.begin(), multiPartition.end(), -1);
+			activeVersion = lattice->activeVersion;
+		}
+		lattice->withKernel ([this, lambda] (auto kernel) {
+			lattice->sweep ([this, lambda, &kernel] (const long *order, long nb, long *ids) {
+				Counts counts;
+				for (long i = 0; i < nb; i++) kernel.computeCost (this, order[i], lambda, ids, counts);
+				Profile::addCost (counts);
+			}, true, threadNb, true);
+		});
+		Profile::add (Profile::costPrunes, lattice->multiSubsetNb - lattice->getActiveNb ());
+	}
+
+	else if (! dirtyIds.empty()) {
+		std::vector<std::pair<int,long>> levelIds;
+		levelIds.reserve (dirtyIds.size());
+		for (long id : dirtyIds) {
+			int level = 0;
+			for (int d = 0; d < lattice->dim; d++) { level += lattice->multiSet->sets[d]->getHeight (lattice->getSubsetId (id, d)); }
+			levelIds.push_back (std::pair<int,long> (level, id));
+		}
+		std::sort (levelIds.begin(), levelIds.end());
+
+		ids.resize (lattice->maxPartitionSize);
+		Counts counts;
+		lattice->withKernel ([&] (auto kernel) { for (std::pair<int,long> &levelId : levelIds) kernel.computeCost (this, levelId.second, lambda, ids.data(), counts); });
+		Profile::addCost (counts);
+		Profile::add (Profile::costMemoHits, lattice->multiSubsetNb - dirtyIds.size());
+	}
+
+	else { Profile::add (Profile::costMemoHits, lattice->multiSubsetNb); }
+
+	costLambda = lambda;
+	for (long id : dirtyIds) { dirty[id] = false; }
+	dirtyIds.clear ();
+}
+
+
+MultiPartition *Solver::getMultiPartition (double lambda, long rootId)
+{
+	Profile profile ("getMultiPartition");
+	releaseResults ();
+	computeCost (lambda);
+
+	MultiPartition *result = resultPool.create (lattice->dim);
+	std::list<long> idQueue;
+	idQueue.push_back ((rootId < 0) ? lattice->topId : rootId);
+
+	ids.resize (lattice->maxPartitionSize);
+	while (! idQueue.empty()) {
+		long id = idQueue.front();
+		idQueue.pop_front();
+
+		if (multiPartition[id] < 0) {
+			MultiSubset *multiSubset = lattice->getMultiSubset (id, viewPool);
+			multiSubset->cost = cost[id];
+			result->addMultiSubset (multiSubset);
+		}
+		else {
+			int size = lattice->getMultiSubsetIds (id, multiPartition[id], ids.data());
+			for (int c = 0; c < size; c++) { idQueue.push_back (ids[c]); }
+		}
+	}
+
+	return result;
+}
+
+
+void Solver::computeCosts (const std::vector<double> &vLambdas)
+{
+	Profile profile ("computeCost");
+	laneNb = (vLambdas.size() + 7) / 8 * 8;
+	lambdas = vLambdas;
+	lambdas.resize (laneNb, vLambdas.empty() ? 0 : vLambdas.back());
+
+	double scale = (laneLosses != NULL) ? 1 : lattice->getLossScale ();
+	for (double &lambda : lambdas) { lambda *= scale; }
+
+	if ((long) laneCosts.size() != lattice->multiSubsetNb * laneNb) {
+		laneCosts.resize (lattice->multiSubsetNb * laneNb);
+		laneMultiPartitions.resize (lattice->multiSubsetNb * laneNb);
+		laneActiveVersion = -1;
+	}
+
+	if (laneLosses != NULL) {
+		laneActiveVersion = -1;
+		lattice->sweep ([this] (const long *order, long nb, long *ids) {
+			Counts counts;
+			for (long i = 0; i < nb; i++) computeCosts (order[i], ids, counts);
+			Profile::addCost (counts);
+		}, true, threadNb);
+		return;
+	}
+
+	if (lattice->activeStale) lattice->buildActiveOrder ();
+	if (laneActiveVersion != lattice->activeVersion) {
+		std::fill (laneCosts.begin(), laneCosts.end(), 1);
+		std::fill (laneMultiPartitions.begin(), laneMultiPartitions.end(), -1);
+		laneActiveVersion = lattice->activeVersion;
+	}
+
+	lattice->sweep ([this] (const long *order, long nb, long *ids) {
+		Counts counts;
+		for (long i = 0; i < nb; i++) computeCosts (order[i], ids, counts);
+		Profile::addCost (counts);
+	}, true, threadNb, true);
+	Profile::add (Profile::costPrunes, lattice->multiSubsetNb - lattice->getActiveNb ());
+}
+
+
+void Solver::computeCosts (long id, long *ids, Counts &counts)
+{
+	double *costs = &laneCosts[id * laneNb];
+	int *choices = &laneMultiPartitions[id * laneNb];
+
+	bool zero = true;
+	for (int l = 0; l < laneNb; l++) {
+		double loss = (laneLosses != NULL) ? laneLosses[id * laneNb + l] : lattice->loss[id];
+		costs[l] = 1 + lambdas[l] * loss;
+		choices[l] = -1;
+		if (loss != 0) { zero = false; }
+	}
+
+	int multiPartitionNb = zero ? 0 : lattice->getMultiPartitionNb (id);
+	for (int k = 0; k < multiPartitionNb; k++) {
+		int size = lattice->getMultiSubsetIds (id, k, ids);
+		if (size >= *std::max_element (costs, costs + laneNb)) { counts.prunes++; continue; }
+		counts.visits += size;
+
+		for (int l = 0; l < laneNb; l += 8) {
+			unsigned int mask = 0;
+
+#if defined(__AVX512F__)
+			__m512d nextCosts = _mm512_setzero_pd ();
+			for (int c = 0; c < size; c++) { nextCosts = _mm512_add_pd (nextCosts, _mm512_loadu_pd (&laneCosts[ids[c] * laneNb + l])); }
+			__m512d currentCosts = _mm512_loadu_pd (costs + l);
+			__mmask8 lower = _mm512_cmp_pd_mask (nextCosts, currentCosts, _CMP_LT_OQ);
+			_mm512_storeu_pd (costs + l, _mm512_mask_blend_pd (lower, currentCosts, nextCosts));
+			mask = lower;
+#elif defined(__AVX2__)
+			for (int h = 0; h < 8; h += 4) {
+				__m256d nextCosts = _mm256_setzero_pd ();
+				for (int c = 0; c < size; c++) { nextCosts = _mm256_add_pd (nextCosts, _mm256_loadu_pd (&laneCosts[ids[c] * laneNb + l + h])); }
+				__m256d currentCosts = _mm256_loadu_pd (costs + l + h);
+				__m256d lower = _mm256_cmp_pd (nextCosts, currentCosts, _CMP_LT_OQ);
+				_mm256_storeu_pd (costs + l + h, _mm256_blendv_pd (currentCosts, nextCosts, lower));
+				mask |= _mm256_movemask_pd (lower) << h;
+			}
+#else
+			double nextCosts [8] = {0, 0, 0, 0, 0, 0, 0, 0};
+			for (int c = 0; c < size; c++) {
+				const double *childCosts = &laneCosts[ids[c] * laneNb + l];
+				for (int h = 0; h < 8; h++) { nextCosts[h] += childCosts[h]; }
+			}
+			for (int h = 0; h < 8; h++) {
+				if (nextCosts[h] < costs[l+h]) { costs[l+h] = nextCosts[h]; mask |= 1 << h; }
+			}
+#endif
+
+			for (int h = 0; mask != 0; h++, mask >>= 1) { if (mask & 1) choices[l+h] = k; }
+		}
+	}
+}
+
+
+std::vector<MultiPartition*> Solver::getMultiPartition (const std::vector<double> &vLambdas)
+{
+	Profile profile ("getMultiPartition");
+	releaseResults ();
+	computeCosts (vLambdas);
+
+	std::vector<MultiPartition*> results;
+	ids.resize (lattice->maxPartitionSize);
+	for (unsigned int l = 0; l < vLambdas.size(); l++) {
+		MultiPartition *result = resultPool.create (lattice->dim);
+		std::list<long> idQueue;
+		idQueue.push_back (lattice->topId);
+
+		while (! idQueue.empty()) {
+			long id = idQueue.front();
+			idQueue.pop_front();
+
+			int k = laneMultiPartitions[id * laneNb + l];
+			if (k < 0) {
+				MultiSubset *multiSubset = lattice->getMultiSubset (id, viewPool);
+				multiSubset->cost = laneCosts[id * laneNb + l];
+				result->addMultiSubset (multiSubset);
+			}
+			else {
+				int size = lattice->getMultiSubsetIds (id, k, ids.data());
+				for (int c = 0; c < size; c++) { idQueue.push_back (ids[c]); }
+			}
+		}
+
+		results.push_back (result);
+	}
+
+	return results;
+}
+
+
+void Solver::computePath (double lambdaMin, double lambdaMax)
+{
+	Profile profile ("computePath");
+	pathLambdaMin = lambdaMin;
+	pathLambdaMax = lambdaMax;
+
+	segments.clear ();
+	segmentBegins.assign (lattice->multiSubsetNb, 0);
+	segmentEnds.assign (lattice->multiSubsetNb, 0);
+
+	ids.resize (lattice->maxPartitionSize);
+	positions.resize (lattice->maxPartitionSize);
+	if (lattice->streaming) { for (long id = 0; id < lattice->multiSubsetNb; id++) computePath (id, lines, ids.data(), positions.data()); }
+	else { for (long id : lattice->order) computePath (id, lines, ids.data(), positions.data()); }
+}
+
+
+void Solver::computePath (long id, std::vector<Segment> &lines, long *ids, long *positions)
+{
+	lines.clear ();
+	lines.push_back (Segment (pathLambdaMin, 1, lattice->loss[id] * lattice->getLossScale (), -1));
+
+	int multiPartitionNb = (lattice->loss[id] == 0) ? 0 : lattice->getMultiPartitionNb (id);
+	for (int k = 0; k < multiPartitionNb; k++) {
+		int size = lattice->getMultiSubsetIds (id, k, ids);
+		for (int c = 0; c < size; c++) { positions[c] = segmentBegins[ids[c]]; }
+
+		double lambda = pathLambdaMin;
+		while (true) {
+			int nextSize = 0;
+			double nextLoss = 0;
+			double nextLambda = pathLambdaMax;
+			for (int c = 0; c < size; c++) {
+				nextSize += segments[positions[c]].size;
+				nextLoss += segments[positions[c]].loss;
+				if (positions[c] + 1 < segmentEnds[ids[c]]) { nextLambda = std::min (nextLambda, segments[positions[c] + 1].lambda); }
+			}
+			lines.push_back (Segment (lambda, nextSize, nextLoss, k));
+
+			if (nextLambda >= pathLambdaMax) break;
+			for (int c = 0; c < size; c++) {
+				if (positions[c] + 1 < segmentEnds[ids[c]] && segments[positions[c] + 1].lambda <= nextLambda) { positions[c]++; }
+			}
+			lambda = nextLambda;
+		}
+	}
+
+	computeEnvelope (lines);
+
+	segmentBegins[id] = segments.size();
+	segments.insert (segments.end(), lines.begin(), lines.end());
+	segmentEnds[id] = segments.size();
+}
+
+
+void Solver::computeEnvelope (std::vector<Segment> &lines)
+{
+	std::stable_sort (lines.begin(), lines.end(), [] (const Segment &a, const Segment &b) { return a.loss > b.loss; });
+
+	auto parallel = [] (const Segment &a, const Segment &b) { return std::abs (a.loss - b.loss) <= 1e-12 * std::max (1.0, std::abs (a.loss)); };
+	auto intersection = [] (const Segment &a, const Segment &b) { return (b.size - a.size) / (a.loss - b.loss); };
+	auto before = [] (double lambda1, double lambda2) { return lambda1 <= lambda2 + 1e-9 * std::max (1.0, std::abs (lambda2)); };
+
+	std::vector<Segment> hull;
+	for (const Segment &line : lines) {
+		if (! hull.empty() && parallel (hull.back(), line)) {
+			if (line.size >= hull.back().size) continue;
+			hull.pop_back ();
+		}
+		while (hull.size() >= 2 && before (intersection (hull[hull.size()-2], line), intersection (hull[hull.size()-2], hull.back()))) { hull.pop_back (); }
+		hull.push_back (line);
+	}
+
+	lines.clear ();
+	for (unsigned int i = 0; i < hull.size(); i++) {
+		double lambdaBegin = (i == 0) ? - std::numeric_limits<double>::infinity() : intersection (hull[i-1], hull[i]);
+		double lambdaEnd = (i + 1 == hull.size()) ? std::numeric_limits<double>::infinity() : intersection (hull[i], hull[i+1]);
+		if (lambdaEnd <= pathLambdaMin || lambdaBegin >= pathLambdaMax || lambdaEnd <= lambdaBegin) continue;
+
+		hull[i].lambda = std::max (lambdaBegin, pathLambdaMin);
+		lines.push_back (hull[i]);
+	}
+}
+
+
+long Solver::getSegment (long id, double lambda)
+{
+	long begin = segmentBegins[id];
+	long end = segmentEnds[id];
+	while (end - begin > 1) {
+		long middle = (begin + end) / 2;
+		if (segments[middle].lambda <= lambda) { begin = middle; } else { end = middle; }
+	}
+	return begin;
+}
+
+
+std::vector<MultiPartition*> Solver::getRegularizationPath (double lambdaMin, double lambdaMax)
+{
+	Profile profile ("getRegularizationPath");
+	releaseResults ();
+	computePath (lambdaMin, lambdaMax);
+
+	std::vector<MultiPartition*> path;
+	long topId = lattice->topId;
+	ids.resize (lattice->maxPartitionSize);
+	for (long s = segmentBegins[topId]; s < segmentEnds[topId]; s++) {
+		MultiPartition *result = resultPool.create (lattice->dim);
+		result->lambdaMin = segments[s].lambda;
+		result->lambdaMax = (s + 1 < segmentEnds[topId]) ? segments[s+1].lambda : lambdaMax;
+
+		double lambda = result->lambdaMin + 1;
+		if (std::isfinite (result->lambdaMax)) { lambda = (result->lambdaMin + result->lambdaMax) / 2; }
+		else if (result->lambdaMin > 0) { lambda = 2 * result->lambdaMin; }
+
+		std::list<long> idQueue;
+		idQueue.push_back (topId);
+		while (! idQueue.empty()) {
+			long id = idQueue.front();
+			idQueue.pop_front();
+
+			int k = segments[getSegment (id, lambda)].multiPartition;
+			if (k < 0) {
+				MultiSubset *multiSubset = lattice->getMultiSubset (id, viewPool);
+				multiSubset->cost = 1 + result->lambdaMin * multiSubset->loss;
+				result->addMultiSubset (multiSubset);
+			}
+			else {
+				int size = lattice->getMultiSubsetIds (id, k, ids.data());
+				for (int c = 0; c < size; c++) { idQueue.push_back (ids[c]); }
+			}
+		}
+
+		path.push_back (result);
+	}
+
+	return path;
+}
+
+
+int Lattice::getSubsetId (long id, int d) { return (id / strides[d]) % multiSet->sets[d]->subsetNb; }
+
+
+int Lattice::getMultiPartitionNb (long id)
+{
+	if (! implicit) return multiPartitionOffsets[id+1] - multiPartitionOffsets[id];
+
+	int nb = 0;
+	for (int d = 0; d < dim; d++) { nb += multiSet->sets[d]->getPartitionNb (getSubsetId (id, d)); }
+	return nb;
+}
+
+
+int Lattice::getMultiSubsetIds (long id, int k, long *ids)
+{
+	if (! implicit) {
+		long p = multiPartitionOffsets[id] + k;
+		long begin = multiSubsetOffsets[p];
+		int size = multiSubsetOffsets[p+1] - begin;
+		for (int c = 0; c < size; c++) { ids[c] = multiSubsetIds[begin + c]; }
+		return size;
+	}
+
+	for (int d = 0; d < dim; d++) {
+		Set *set = multiSet->sets[d];
+		int subsetId = getSubsetId (id, d);
+		int nb = set->getPartitionNb (subsetId);
+		if (k >= nb) { k -= nb; continue; }
+
+		int size = set->getPartitionSubsets (subsetId, k, ids);
+		for (int c = 0; c < size; c++) { ids[c] = id + (ids[c] - subsetId) * strides[d]; }
+		return size;
+	}
+
+	return 0;
+}
+
+
+MultiSubset *Lattice::getMultiSubset (long id, Pool<MultiSubset> &pool)
+{
+	MultiSubset *multiSubset = pool.create (multiSet);
+	multiSubset->id = id;
+	multiSubset->top = true;
+	multiSubset->bot = true;
+	for (int d = 0; d < dim; d++) {
+		Subset *subset = multiSet->sets[d]->getSubset (getSubsetId (id, d));
+		multiSubset->addSubset (subset);
+		multiSubset->top = multiSubset->top && subset->top;
+		multiSubset->bot = multiSubset->bot && subset->bot;
+	}
+
+	multiSubset->multiElementNb = multiElementNb[id];
+	multiSubset->sumValue = sumValue[id];
+	multiSubset->sumInfo = sumInfo[id];
+	multiSubset->loss = loss[id] * getLossScale ();
+	return multiSubset;
+}
+
+
+
+Segment::Segment (double vLambda, int vSize, double vLoss, int vMultiPartition) : lambda (vLambda), size (vSize), loss (vLoss), multiPartition (vMultiPartition) {}
+
+
+
+Writer::Writer (std::ostream &vOutput, Format vFormat) : output (&vOutput), format (vFormat) {}
+
+
+Writer::Writer (int vFd, Format vFormat) : fd (vFd), format (vFormat) {}
+
+
+Writer::~Writer () { flush (); }
+
+
+void Writer::writeHeader (MultiSet *multiSet)
+{
+	if (format == CSV) {
+		put ("partition,lambdaMin,lambdaMax");
+		for (Set *set : multiSet->sets) { put (','); putName (set->name); }
+		put (",size,mean,loss\n");
+	}
+
+	if (format == BINARY) {
+		put ("MCW1", 4);
+		putBinary<int> (multiSet->dim);
+	}
+}
+
+
+void Writer::write (MultiPartition *multiPartition)
+{
+	if (format == BINARY) {
+		putBinary<long> (multiPartition->multiSubsets.size());
+		putBinary<double> (multiPartition->lambdaMin);
+		putBinary<double> (multiPartition->lambdaMax);
+		putBinary<double> (multiPartition->loss);
+		putBinary<double> (multiPartition->cost);
+	}
+
+	for (MultiSubset *multiSubset : multiPartition->multiSubsets) {
+		double mean = multiSubset->sumValue / multiSubset->multiElementNb;
+
+		if (format == CSV) {
+			putNumber (partitionNb);
+			put (','); putNumber (multiPartition->lambdaMin);
+			put (','); putNumber (multiPartition->lambdaMax);
+			for (Subset *subset : multiSubset->subsets) { put (','); putName (subset->name); }
+			put (','); putNumber (multiSubset->multiElementNb);
+			put (','); putNumber (mean);
+			put (','); putNumber (multiSubset->loss);
+			put ('\n');
+		}
+
+		if (format == JSONL) {
+			put ("{\"partition\":"); putNumber (partitionNb);
+			put (",\"lambda\":["); putNumber (multiPartition->lambdaMin); put (','); putNumber (multiPartition->lambdaMax); put (']');
+			if (! std::isnan (multiPartition->lowerBound)) { put (",\"cost\":"); putNumber (multiPartition->cost); put (",\"lowerBound\":"); putNumber (multiPartition->lowerBound); }
+			put (",\"ids\":[");
+			for (int d = 0; d < multiSubset->dim; d++) { if (d > 0) put (','); putNumber ((long) multiSubset->subsets[d]->id); }
+			put ("],\"names\":[");
+			for (int d = 0; d < multiSubset->dim; d++) { if (d > 0) put (','); putName (multiSubset->subsets[d]->name); }
+			put ("],\"size\":"); putNumber (multiSubset->multiElementNb);
+			put (",\"mean\":"); putNumber (mean);
+			put (",\"loss\":"); putNumber (multiSubset->loss);
+			put ("}\n");
+		}
+
+		if (format == BINARY) {
+			for (Subset *subset : multiSubset->subsets) { putBinary<int> (subset->id); }
+			putBinary<long> (multiSubset->multiElementNb);
+			putBinary<double> (mean);
+			putBinary<double> (multiSubset->loss);
+		}
+	}
+
+	partitionNb++;
+}
+
+
+void Writer::flush ()
+{
+	if (length == 0) return;
+	if (output != NULL) { output->write (buffer, length); output->flush (); }
+
+	for (int offset = 0; fd >= 0 && offset < length; ) {
+		ssize_t written = ::write (fd, buffer + offset, length - offset);
+		if (written < 0 && errno == EINTR) continue;
+		if (written <= 0) { std::cerr << "ERROR: Cannot write results to descriptor " << fd << std::endl; break; }
+		offset += written;
+	}
+
+	length = 0;
+}
+
+
+void Writer::put (const char *data, long size)
+{
+	if (length + size > bufferSize) flush ();
+	if (size > bufferSize) {
+		for (long offset = 0; offset < size; offset += bufferSize) { put (data + offset, std::min ((long) bufferSize, size - offset)); }
+		return;
+	}
+	memcpy (buffer + length, data, size);
+	length += size;
+}
+
+
+void Writer::putNumber (long value)
+{
+	char number [32];
+	std::to_chars_result result = std::to_chars (number, number + sizeof (number), value);
+	put (number, result.ptr - number);
+}
+
+
+void Writer::putNumber (double value)
+{
+	if (! std::isfinite (value)) { put ((format == JSONL) ? "null" : (std::isnan (value) ? "nan" : (value > 0 ? "inf" : "-inf"))); return; }
+	char number [32];
+	std::to_chars_result result = std::to_chars (number, number + sizeof (number), value);
+	put (number, result.ptr - number);
+}
+
+
+void Writer::putName (std::string_view name)
+{
+	if (format == JSONL) {
+		put ('"');
+		for (char c : name) {
+			if (c == '"' || c == '\\') { put ('\\'); put (c); }
+			else if ((unsigned char) c < 0x20) {
+				char escape [8];
+				snprintf (escape, sizeof (escape), "\\u%04x", (unsigned char) c);
+				put (escape, 6);
+			}
+			else put (c);
+		}
+		put ('"');
+		return;
+	}
+
+	if (name.find_first_of (",\"\n\r") == std::string_view::npos) { put (name); return; }
+	put ('"');
+	for (char c : name) { if (c == '"') put ('"'); put (c); }
+	put ('"');
+}
+
+
+
+Connection::Connection (int vClient) : client (vClient) {}
+
+
+Connection::~Connection ()
+{
+	delete multiSet;
+	close (client);
+}
+
+
+Server::Server (MultiSet *vMultiSet, int vThreadNb) : multiSet (vMultiSet), threadNb (vThreadNb)
+{
+	if (threadNb <= 0) threadNb = std::max (1, (int) std::thread::hardware_concurrency());
+}
+
+
+std::string Server::answer (const std::string &request, Solver &solver)
+{
+	Lattice *lattice = solver.lattice;
+	if (lattice == NULL) return request + "\tERROR: No lattice to query (see buildLattice)\n";
+
+	std::vector<double> lambdas;
+	std::string_view line (request), token;
+	while (MappedFile::nextToken (line, token)) {
+		double lambda;
+		std::from_chars_result result = std::from_chars (token.data(), token.data() + token.size(), lambda);
+		if (result.ec != std::errc() || result.ptr != token.data() + token.size()) return request + "\tERROR: Unreadable lambda '" + std::string (token) + "'\n";
+		if (! (lambda >= 0)) return request + "\tERROR: Negative lambda '" + std::string (token) + "'\n";
+		lambdas.push_back (lambda);
+	}
+	if (lambdas.empty() || lambdas.size() > 2) return request + "\tERROR: Expected a lambda or a range of lambdas\n";
+
+	std::vector<MultiPartition*> results;
+	std::string str = "";
+	if (lambdas.size() == 1) { results.push_back (solver.getMultiPartition (lambdas[0])); }
+	else {
+		results = solver.getRegularizationPath (lambdas[0], lambdas[1]);
+		str += request + "\t" + std::to_string (results.size()) + " segments\n";
+	}
+
+	for (MultiPartition *result : results) { str += request + "\t" + result->toString (true) + "\n"; }
+	return str;
+}
+
+
+void Server::serve (std::istream &input, std::ostream &output)
+{
+	std::list<std::string> requests;
+	bool done = false;
+	std::mutex mutex;
+	std::condition_variable condition;
+
+	auto worker = [&] () {
+		Solver solver (multiSet->lattice);
+		while (true) {
+			std::string request;
+			{
+				std::unique_lock<std::mutex> lock (mutex);
+				condition.wait (lock, [&] () { return done || ! requests.empty(); });
+				if (requests.empty()) return;
+				request = requests.front();
+				requests.pop_front();
+			}
+
+			std::string response = answer (request, solver);
+			std::lock_guard<std::mutex> lock (outputMutex);
+			output << response << std::flush;
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (int t = 0; t < threadNb; t++) { threads.push_back (std::thread (worker)); }
+
+	std::string line;
+	while (std::getline (input, line)) {
+		if (line.find_first_not_of (" \t\r") == std::string::npos) continue;
+		std::lock_guard<std::mutex> lock (mutex);
+		requests.push_back (line);
+		condition.notify_one ();
+	}
+
+	{
+		std::lock_guard<std::mutex> lock (mutex);
+		done = true;
+	}
+	condition.notify_all ();
+	for (std::thread &thread : threads) { thread.join(); }
+}
+
+
+void Server::listen (std::string host, int port)
+{
+	int server = openSocket (host, port);
+	if (server < 0) return;
+
+	acceptRequests (server, threadNb, [this] (const std::function<Connection* (Connection *previous, bool open)> &nextRequest) {
+		Solver solver (multiSet->lattice);
+		Connection *connection = NULL;
+		bool open = true;
+		while (true) {
+			connection = nextRequest (connection, open);
+			open = sendAll (connection->client, answer (connection->request, solver));
+		}
+	});
+}
+
+
+void Server::acceptRequests (int server, int threadNb, const std::function<void (const std::function<Connection* (Connection *previous, bool open)> &nextRequest)> &worker)
+{
+	int wake [2];
+	if (pipe (wake) < 0) { std::cerr << "ERROR: Cannot create the pipe of the connection pool" << std::endl; return; }
+
+	std::vector<Connection*> idle;
+	std::list<Connection*> ready;
+	std::mutex mutex;
+	std::condition_variable condition;
+
+	auto release = [&] (Connection *connection) {
+		if (connection->buffer.find ('\n') != std::string::npos) { ready.push_back (connection); condition.notify_one (); }
+		else { idle.push_back (connection); if (write (wake[1], "", 1) < 0) {} }
+	};
+
+	auto nextRequest = [&] (Connection *previous, bool open) {
+		std::unique_lock<std::mutex> lock (mutex);
+		if (previous != NULL) { if (open) { release (previous); } else { delete previous; } }
+
+		while (true) {
+			condition.wait (lock, [&] () { return ! ready.empty(); });
+			Connection *connection = ready.front();
+			ready.pop_front();
+
+			lock.unlock ();
+			bool received = receiveLine (connection->client, connection->buffer, connection->request);
+			lock.lock ();
+
+			if (! received) { delete connection; }
+			else if (connection->request.find_first_not_of (" \t") == std::string::npos) { release (connection); }
+			else { return connection; }
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (int t = 0; t < threadNb; t++) { threads.push_back (std::thread (worker, nextRequest)); }
+
+	while (true) {
+		std::vector<Connection*> polled;
+		{
+			std::lock_guard<std::mutex> lock (mutex);
+			polled = idle;
+		}
+
+		std::vector<struct pollfd> fds = { { server, POLLIN, 0 }, { wake[0], POLLIN, 0 } };
+		for (Connection *connection : polled) { fds.push_back ({ connection->client, POLLIN, 0 }); }
+		if (poll (fds.data(), fds.size(), -1) < 0) continue;
+
+		if (fds[1].revents != 0) { char chunk [64]; if (read (wake[0], chunk, sizeof (chunk)) < 0) {} }
+
+		std::lock_guard<std::mutex> lock (mutex);
+		if (fds[0].revents & POLLIN) {
+			int client = accept (server, NULL, NULL);
+			if (client >= 0) { idle.push_back (new Connection (client)); }
+		}
+
+		for (unsigned int i = 0; i < polled.size(); i++) {
+			if (fds[i+2].revents == 0) continue;
+			idle.erase (std::find (idle.begin(), idle.end(), polled[i]));
+			ready.push_back (polled[i]);
+			condition.notify_one ();
+		}
+	}
+}
+
+
+int Server::openSocket (std::string host, int port)
+{
+	struct addrinfo hints;
+	memset (&hints, 0, sizeof (hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+
+	struct addrinfo *results = NULL;
+	if (getaddrinfo (host.c_str(), std::to_string (port).c_str(), &hints, &results) != 0) { std::cerr << "ERROR: Cannot resolve address " << host << std::endl; return -1; }
+
+	int server = -1;
+	for (struct addrinfo *result = results; result != NULL && server < 0; result = result->ai_next) {
+		server = socket (result->ai_family, result->ai_socktype, result->ai_protocol);
+		if (server < 0) continue;
+		int reuse = 1;
+		setsockopt (server, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof (reuse));
+		if (bind (server, result->ai_addr, result->ai_addrlen) < 0 || ::listen (server, 16) < 0) { close (server); server = -1; }
+	}
+	freeaddrinfo (results);
+
+	if (server < 0) { std::cerr << "ERROR: Cannot listen on " << host << ":" << port << std::endl; }
+	return server;
+}
+
+
+int Server::connectSocket (std::string address)
+{
+	size_t colon = address.find_last_of (':');
+	std::string host = (colon == std::string::npos) ? "localhost" : address.substr (0, colon);
+	std::string port = (colon == std::string::npos) ? address : address.substr (colon + 1);
+
+	struct addrinfo hints;
+	memset (&hints, 0, sizeof (hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	struct addrinfo *results = NULL;
+	if (getaddrinfo (host.c_str(), port.c_str(), &hints, &results) != 0) { std::cerr << "ERROR: Cannot resolve worker " << address << std::endl; return -1; }
+
+	int client = -1;
+	for (struct addrinfo *result = results; result != NULL && client < 0; result = result->ai_next) {
+		client = socket (result->ai_family, result->ai_socktype, result->ai_protocol);
+		if (client >= 0 && ::connect (client, result->ai_addr, result->ai_addrlen) < 0) { close (client); client = -1; }
+	}
+	freeaddrinfo (results);
+
+	if (client < 0) { std::cerr << "ERROR: Cannot connect to worker " << address << std::endl; }
+	return client;
+}
+
+
+bool Server::sendAll (int client, const std::string &data)
+{
+	for (size_t sent = 0; sent < data.size(); ) {
+		long n = send (client, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+		if (n <= 0) return false;
+		sent += n;
+	}
+	return true;
+}
+
+
+bool Server::receiveLine (int client, std::string &buffer, std::string &line)
+{
+	char chunk [4096];
+	size_t end;
+	while ((end = buffer.find ('\n')) == std::string::npos) {
+		long n = recv (client, chunk, sizeof (chunk), 0);
+		if (n <= 0) return false;
+		buffer.append (chunk, n);
+	}
+
+	line = buffer.substr (0, end);
+	buffer.erase (0, end + 1);
+	if (! line.empty() && line.back() == '\r') { line.pop_back(); }
+	return true;
+}
+
+
+
+Worker::Worker (Driver *vDriver) : driver (vDriver) {}
+
+
+void Worker::listen (std::string host, int port)
+{
+	int server = Server::openSocket (host, port);
+	if (server < 0) return;
+
+	int threadNb = (driver->threadNb > 0) ? driver->threadNb : std::max (1, (int) std::thread::hardware_concurrency());
+	Server::acceptRequests (server, threadNb, [this] (const std::function<Connection* (Connection *previous, bool open)> &nextRequest) {
+		Connection *connection = NULL;
+		bool open = true;
+		while (true) {
+			connection = nextRequest (connection, open);
+			open = Server::sendAll (connection->client, answer (connection->request, connection->multiSet, connection->shardDim));
+		}
+	});
+}
+
+
+std::string Worker::answer (const std::string &request, MultiSet *&multiSet, int &shardDim)
+{
+	std::vector<std::string_view> tokens;
+	std::string_view line (request), token;
+	while (MappedFile::nextToken (line, token)) { tokens.push_back (token); }
+
+	std::vector<double> numbers;
+	for (unsigned int t = 1; t < tokens.size(); t++) {
+		double number;
+		std::from_chars_result result = std::from_chars (tokens[t].data(), tokens[t].data() + tokens[t].size(), number);
+		if (result.ec != std::errc() || result.ptr != tokens[t].data() + tokens[t].size()) return "ERROR: Unreadable number '" + std::string (tokens[t]) + "'\n";
+		numbers.push_back (number);
+	}
+
+	if (tokens[0] == "shard" && numbers.size() == 2) {
+		int dimNb = driver->dimensions.size();
+		if (numbers[0] != (int) numbers[0] || numbers[0] < 0 || (numbers[0] >= dimNb && driver->snapshotFile == "")) return "ERROR: Expected a dimension in [0, " + std::to_string (dimNb) + ") instead of '" + std::string (tokens[1]) + "'\n";
+		if (numbers[1] != (int) numbers[1] || numbers[1] < -1) return "ERROR: Expected a shard of at least -1 instead of '" + std::string (tokens[2]) + "'\n";
+
+		delete multiSet;
+		shardDim = numbers[0];
+		int shard = numbers[1];
+		std::string suffix = "." + std::to_string (shardDim) + "." + std::to_string (shard);
+
+		if (driver->snapshotFile != "") {
+			multiSet = driver->loadSnapshot (driver->snapshotFile + suffix);
+			if (multiSet != NULL && shardDim >= multiSet->dim) { delete multiSet; multiSet = NULL; }
+			if (multiSet == NULL) return "ERROR: Cannot load the snapshot of shard " + std::to_string (shard) + " of dimension " + std::to_string (shardDim) + "\n";
+		}
+
+		else {
+			multiSet = driver->load (shardDim, shard);
+			if (multiSet == NULL) return "ERROR: Cannot load shard " + std::to_string (shard) + " of dimension " + std::to_string (shardDim) + "\n";
+			if (! multiSet->buildLattice (driver->implicit, driver->threadNb, driver->prefixSums, driver->columnDirectory)) {
+				delete multiSet;
+				multiSet = NULL;
+				return "ERROR: Cannot build the lattice of shard " + std::to_string (shard) + "\n";
+			}
+		}
+
+		if (driver->saveSnapshotFile != "" && ! multiSet->saveSnapshot (driver->saveSnapshotFile + suffix)) {
+			delete multiSet;
+			multiSet = NULL;
+			return "ERROR: Cannot save the snapshot of shard " + std::to_string (shard) + "\n";
+		}
+
+		Lattice *lattice = multiSet->lattice;
+		long sliceNb = lattice->multiSubsetNb / lattice->multiSet->sets[shardDim]->subsetNb;
+		std::string str = std::to_string (sliceNb) + "\n";
+		for (long x = 0; x < sliceNb; x++) {
+			long id = getSliceId (lattice, shardDim, x);
+			str += Coordinator::toString (lattice->sumValue[id]) + "\t" + Coordinator::toString (lattice->sumInfo[id]) + "\t" + std::to_string (lattice->multiElementNb[id]) + "\n";
+		}
+		return str;
+	}
+
+	if (multiSet == NULL) return "ERROR: No shard loaded\n";
+	Lattice *lattice = multiSet->lattice;
+	Solver *solver = lattice->solver;
+	long sliceNb = lattice->multiSubsetNb / lattice->multiSet->sets[shardDim]->subsetNb;
+	if (! numbers.empty() && ! (numbers.back() >= 0)) return "ERROR: Negative lambda '" + std::string (tokens.back()) + "'\n";
+
+	if (tokens[0] == "cost" && numbers.size() == 1) {
+		solver->computeCost (numbers[0]);
+		std::string str = std::to_string (sliceNb) + "\n";
+		for (long x = 0; x < sliceNb; x++) { str += Coordinator::toString (solver->cost[getSliceId (lattice, shardDim, x)]) + "\n"; }
+		return str;
+	}
+
+	if (tokens[0] == "partition" && numbers.size() == 2) {
+		if (numbers[0] != (long) numbers[0] || numbers[0] < 0 || numbers[0] >= sliceNb) return "ERROR: Expected a slice in [0, " + std::to_string (sliceNb) + ") instead of '" + std::string (tokens[1]) + "'\n";
+		MultiPartition *result = solver->getMultiPartition (numbers[1], getSliceId (lattice, shardDim, numbers[0]));
+		std::string str = std::to_string (result->multiSubsets.size()) + "\n";
+		for (MultiSubset *multiSubset : result->multiSubsets) {
+			for (Subset *subset : multiSubset->subsets) { str += subset->name + "\t"; }
+			str += std::to_string (multiSubset->multiElementNb) + "\t" + Coordinator::toString (multiSubset->sumValue) + "\t" + Coordinator::toString (multiSubset->sumInfo) + "\n";
+		}
+		return str;
+	}
+
+	return "ERROR: Unknown request '" + request + "'\n";
+}
+
+
+long Worker::getSliceId (Lattice *lattice, int shardDim, long x)
+{
+	long id = lattice->multiSet->sets[shardDim]->getTopId () * lattice->strides[shardDim];
+	for (int d = 0; d < lattice->dim; d++) {
+		if (d == shardDim) continue;
+		int subsetNb = lattice->multiSet->sets[d]->subsetNb;
+		id += (x % subsetNb) * lattice->strides[d];
+		x /= subsetNb;
+	}
+	return id;
+}
+
+
+
+Coordinator::Coordinator (MultiSet *vMultiSet, MultiSet *vTopMultiSet, int vShardDim) : multiSet (vMultiSet), topMultiSet (vTopMultiSet), shardDim (vShardDim)
+{
+	Subset *topSubset = multiSet->sets[shardDim]->topSubset;
+	for (Subset *shard : topSubset->partitions.front()->subsets) {
+		std::list<Element*> elements;
+		shard->getElements (elements);
+		shards.push_back (shard);
+		shardSizes.push_back (elements.size());
+		elementNb += elements.size();
+	}
+
+	lattice = new Lattice (topMultiSet, true);
+	topMultiSet->lattice = lattice;
+	lattice->build ();
+}
+
+
+Coordinator::~Coordinator ()
+{
+	for (int client : clients) { if (client >= 0) close (client); }
+}
+
+
+bool Coordinator::connect (const std::vector<std::string> &addresses)
+{
+	for (unsigned int s = 0; s < shards.size(); s++) {
+		int client = Server::connectSocket (addresses[s % addresses.size()]);
+		clients.push_back (client);
+		buffers.push_back ("");
+		if (client < 0 || ! Server::sendAll (client, "shard " + std::to_string (shardDim) + " " + std::to_string (s) + "\n")) return false;
+	}
+	return true;
+}
+
+
+bool Coordinator::computeLoss ()
+{
+	Profile profile ("gatherLoss");
+	std::vector<double> values (lattice->multiSubsetNb, 0);
+	std::vector<double> infos (lattice->multiSubsetNb, 0);
+	std::vector<long> elementNbs (lattice->multiSubsetNb, 0);
+
+	totals.assign (shards.size(), 0);
+	for (unsigned int s = 0; s < shards.size(); s++) {
+		long count;
+		if (! receiveCount (s, count)) return false;
+		if (count != lattice->multiSubsetNb) { std::cerr << "ERROR: Shard " << s << " answered " << count << " multi-subsets instead of " << lattice->multiSubsetNb << std::endl; return false; }
+
+		for (long id = 0; id < count; id++) {
+			std::string line;
+			if (! receive (s, line)) return false;
+			std::string_view cursor (line);
+			double value, info;
+			long elementNb;
+			if (! readNumber (cursor, value) || ! readNumber (cursor, info) || ! readNumber (cursor, elementNb)) { return invalid (s, line); }
+			values[id] += value;
+			infos[id] += info;
+			elementNbs[id] += elementNb;
+			if (id == lattice->topId) { totals[s] = value; }
+		}
+	}
+
+	lattice->computeLoss (values, infos, elementNbs);
+	total = lattice->sumValue[lattice->topId];
+	return true;
+}
+
+
+MultiPartition *Coordinator::getMultiPartition (double lambda)
+{
+	Profile profile ("getMultiPartition");
+	resultPool.clear ();
+	viewPool.clear ();
+
+	splitCosts.assign (lattice->multiSubsetNb, 0);
+	for (unsigned int s = 0; s < shards.size(); s++) {
+		if (totals[s] == 0) { for (double &cost : splitCosts) cost += 1; }
+		else if (! Server::sendAll (clients[s], "cost " + toString (lambda * totals[s] / total) + "\n")) return NULL;
+	}
+
+	for (unsigned int s = 0; s < shards.size(); s++) {
+		if (totals[s] == 0) continue;
+		long count;
+		if (! receiveCount (s, count) || count != lattice->multiSubsetNb) return NULL;
+		for (long id = 0; id < count; id++) {
+			std::string line;
+			if (! receive (s, line)) return NULL;
+			std::string_view cursor (line);
+			double cost;
+			if (! readNumber (cursor, cost)) { invalid (s, line); return NULL; }
+			splitCosts[id] += cost;
+		}
+	}
+
+	Solver *solver = lattice->solver;
+	solver->splitCosts = splitCosts.data();
+	solver->reset ();
+	solver->computeCost (lambda);
+	solver->splitCosts = NULL;
+
+	auto addMultiSubset = [&] (MultiPartition *result, const std::vector<Subset*> &subsets, long elementNb, double value, double info) {
+		MultiSubset *multiSubset = viewPool.create (multiSet);
+		multiSubset->top = true;
+		multiSubset->bot = true;
+		for (Subset *subset : subsets) {
+			multiSubset->addSubset (subset);
+			multiSubset->top = multiSubset->top && subset->top;
+			multiSubset->bot = multiSubset->bot && subset->bot;
+		}
+		multiSubset->multiElementNb = elementNb;
+		multiSubset->sumValue = value;
+		multiSubset->sumInfo = info;
+		multiSubset->loss = lattice->getLoss (value, info, elementNb) / total;
+		multiSubset->cost = 1 + lambda * multiSubset->loss;
+		result->addMultiSubset (multiSubset);
+	};
+
+	MultiPartition *result = resultPool.create (multiSet->dim);
+	std::list<long> idQueue;
+	idQueue.push_back (lattice->topId);
+	std::vector<long> ids (lattice->maxPartitionSize);
+	std::vector<Subset*> subsets (multiSet->dim);
+
+	while (! idQueue.empty()) {
+		long id = idQueue.front();
+		idQueue.pop_front();
+
+		int k = solver->multiPartition[id];
+		if (k >= 0) {
+			int size = lattice->getMultiSubsetIds (id, k, ids.data());
+			for (int c = 0; c < size; c++) { idQueue.push_back (ids[c]); }
+			continue;
+		}
+
+		for (int d = 0; d < multiSet->dim; d++) { subsets[d] = multiSet->sets[d]->getSubset (lattice->getSubsetId (id, d)); }
+		if (k == -1) {
+			subsets[shardDim] = multiSet->sets[shardDim]->topSubset;
+			addMultiSubset (result, subsets, lattice->multiElementNb[id], lattice->sumValue[id], lattice->sumInfo[id]);
+			continue;
+		}
+
+		for (unsigned int s = 0; s < shards.size(); s++) {
+			if (totals[s] != 0 && ! Server::sendAll (clients[s], "partition " + std::to_string (id) + " " + toString (lambda * totals[s] / total) + "\n")) return NULL;
+		}
+
+		for (unsigned int s = 0; s < shards.size(); s++) {
+			if (totals[s] == 0) {
+				subsets[shardDim] = shards[s];
+				addMultiSubset (result, subsets, lattice->multiElementNb[id] / elementNb * shardSizes[s], 0, 0);
+				continue;
+			}
+
+			long count;
+			if (! receiveCount (s, count)) return NULL;
+			for (long c = 0; c < count; c++) {
+				std::string line;
+				if (! receive (s, line)) return NULL;
+				std::string_view cursor (line), token;
+				int d = 0;
+				for (; d < multiSet->dim && MappedFile::nextToken (cursor, token); d++) {
+					subsets[d] = multiSet->sets[d]->getSubset (std::string (token));
+					if (subsets[d] == NULL) break;
+				}
+				long elementNb;
+				double value, info;
+				if (d < multiSet->dim || ! readNumber (cursor, elementNb) || ! readNumber (cursor, value) || ! readNumber (cursor, info)) { invalid (s, line); return NULL; }
+				addMultiSubset (result, subsets, elementNb, value, info);
+			}
+		}
+	}
+
+	return result;
+}
+
+
+bool Coordinator::receive (int s, std::string &line)
+{
+	if (Server::receiveLine (clients[s], buffers[s], line)) return true;
+	std::cerr << "ERROR: Lost the connection to the worker of shard " << s << std::endl;
+	return false;
+}
+
+
+bool Coordinator::receiveCount (int s, long &count)
+{
+	std::string line;
+	if (! receive (s, line)) return false;
+	std::string_view cursor (line);
+	if (readNumber (cursor, count) && cursor.find_first_not_of (" \t") == std::string_view::npos) return true;
+	return invalid (s, line);
+}
+
+
+bool Coordinator::invalid (int s, const std::string &line)
+{
+	std::cerr << "ERROR: Worker of shard " << s << " answered '" << line << "'" << std::endl;
+	return false;
+}
+
+
+template <typename T>
+bool Coordinator::readNumber (std::string_view &line, T &number)
+{
+	std::string_view token;
+	if (! MappedFile::nextToken (line, token)) return false;
+	std::from_chars_result result = std::from_chars (token.data(), token.data() + token.size(), number);
+	return result.ec == std::errc() && result.ptr == token.data() + token.size();
+}
+
+
+std::string Coordinator::toString (double number)
+{
+	char buffer [32];
+	return std::string (buffer, std::to_chars (buffer, buffer + sizeof (buffer), number).ptr);
+}
+
+
+
+MappedFile::MappedFile (std::string filename)
+{
+	int fd = open (filename.c_str(), O_RDONLY);
+	struct stat status;
+	if (fd < 0 || fstat (fd, &status) < 0) { std::cerr << "ERROR: Cannot read file " << filename << std::endl; if (fd >= 0) close (fd); return; }
+
+	size = status.st_size;
+	if (size > 0) { data = (char *) mmap (NULL, size, PROT_READ, MAP_PRIVATE, fd, 0); }
+	close (fd);
+	if (data == MAP_FAILED) { std::cerr << "ERROR: Cannot map file " << filename << std::endl; data = NULL; size = 0; return; }
+	if (data != NULL) { madvise (data, size, MADV_SEQUENTIAL); }
+	valid = true;
+}
+
+
+MappedFile::~MappedFile () { if (data != NULL) munmap (data, size); }
+
+
+bool MappedFile::nextLine (const char *&cursor, const char *end, std::string_view &line)
+{
+	if (cursor == NULL || cursor >= end) return false;
+
+	const char *next = (const char *) memchr (cursor, '\n', end - cursor);
+	if (next == NULL) { next = end; }
+	line = std::string_view (cursor, next - cursor);
+	cursor = (next < end) ? next + 1 : end;
+	return true;
+}
+
+
+bool MappedFile::nextToken (std::string_view &line, std::string_view &token)
+{
+	unsigned long begin = 0;
+	while (begin < line.size() && isspace ((unsigned char) line[begin])) { begin++; }
+	if (begin == line.size()) return false;
+
+	unsigned long end = begin;
+	while (end < line.size() && ! isspace ((unsigned char) line[end])) { end++; }
+	token = line.substr (begin, end - begin);
+	line.remove_prefix (end);
+	return true;
+}
+
+
+
+Barrier::Barrier (int vThreadNb) : threadNb (vThreadNb) {}
+
+
+void Barrier::wait ()
+{
+	std::unique_lock<std::mutex> lock (mutex);
+	long currentGeneration = generation;
+	if (++waitingNb == threadNb) {
+		waitingNb = 0;
+		generation++;
+		condition.notify_all ();
+		return;
+	}
+	condition.wait (lock, [this, currentGeneration] { return generation != currentGeneration; });
+}
+
+
+
+bool Driver::parse (int argc, char *argv[])
+{
+	int a = 1;
+	if (a < argc && std::string (" serve stream bench check worker ").find (" " + std::string (argv[a]) + " ") != std::string::npos) { command = argv[a]; a++; }
+
+	for (; a < argc; a++) {
+		std::string arg = argv[a];
+		bool hasValue = a + 1 < argc;
+		std::string value = hasValue ? argv[a+1] : "";
+		std::vector<double> numbers;
+
+		if (arg == "-h" || arg == "--help") { usage (); return false; }
+		else if (arg == "-s" || arg == "--sparse") { sparse = true; }
+		else if (arg == "-i" || arg == "--implicit") { implicit = true; }
+		else if (arg == "-p" || arg == "--prefix-sums") { prefixSums = true; }
+		else if (arg == "--fixed-normalization") { fixedNormalization = true; }
+		else if (arg == "-v" || arg == "--verbose") { verbose = true; }
+		else if (std::string (" -l --lambda -g --grid -r --range -e --engine -f --format -o --output -R --report -C --columns -t --threads -P --port -B --bind -W --workers -D --shard -b --budget --nodes"
+						 " --snapshot --save-snapshot --dims --sizes --hierarchy --arity --alternatives --density --values --seed ").find (" " + arg + " ") != std::string::npos && ! hasValue) { std::cerr << "ERROR: Missing value after option '" << arg << "'" << std::endl; return false; }
+
+		else if (arg == "-l" || arg == "--lambda") {
+			if (! parseNumbers (value, ',', numbers)) { std::cerr << "ERROR: Unreadable values of lambda '" << value << "'" << std::endl; return false; }
+			if (std::any_of (numbers.begin(), numbers.end(), [] (double lambda) { return ! (lambda >= 0); })) { std::cerr << "ERROR: Values of lambda must be non-negative instead of '" << value << "'" << std::endl; return false; }
+			lambdas.insert (lambdas.end(), numbers.begin(), numbers.end());
+			a++;
+		}
+
+		else if (arg == "-g" || arg == "--grid") {
+			if (! parseNumbers (value, ':', numbers) || numbers.size() != 3 || numbers[2] < 1) { std::cerr << "ERROR: Expected a grid MIN:MAX:N instead of '" << value << "'" << std::endl; return false; }
+			if (! (numbers[0] >= 0 && numbers[1] >= 0)) { std::cerr << "ERROR: Bounds of the grid must be non-negative instead of '" << value << "'" << std::endl; return false; }
+			int n = numbers[2];
+			for (int k = 0; k < n; k++) {
+				double t = (n > 1) ? (double) k / (n - 1) : 0;
+				if (numbers[0] > 0 && numbers[1] > 0) { lambdas.push_back (numbers[0] * pow (numbers[1] / numbers[0], t)); }
+				else { lambdas.push_back (numbers[0] + (numbers[1] - numbers[0]) * t); }
+			}
+			a++;
+		}
+
+		else if (arg == "-r" || arg == "--range") {
+			if (! parseNumbers (value, ':', numbers) || numbers.size() != 2) { std::cerr << "ERROR: Expected a range MIN:MAX instead of '" << value << "'" << std::endl; return false; }
+			if (! (numbers[0] >= 0 && numbers[1] >= 0)) { std::cerr << "ERROR: Bounds of the range must be non-negative instead of '" << value << "'" << std::endl; return false; }
+			lambdaMin = numbers[0];
+			lambdaMax = numbers[1];
+			range = true;
+			a++;
+		}
+
+		else if (arg == "-e" || arg == "--engine") { engine = value; a++; }
+		else if (arg == "-f" || arg == "--format") { format = value; a++; }
+		else if (arg == "-o" || arg == "--output") { outputFile = value; a++; }
+		else if (arg == "-R" || arg == "--report") { reportFile = value; a++; }
+		else if (arg == "-B" || arg == "--bind") { bindAddress = value; a++; }
+		else if (arg == "-C" || arg == "--columns") { columnDirectory = value; a++; }
+		else if (arg == "-D" || arg == "--shard") { shardSet = value; a++; }
+		else if (arg == "--snapshot") { snapshotFile = value; a++; }
+		else if (arg == "--save-snapshot") { saveSnapshotFile = value; a++; }
+
+		else if (arg == "-b" || arg == "--budget" || arg == "--nodes") {
+			if (! parseNumbers (value, ',', numbers) || numbers.size() != 1 || numbers[0] < 0) { std::cerr << "ERROR: Expected a non-negative number after option '" << arg << "'" << std::endl; return false; }
+			if (arg == "--nodes") { nodeBudget = numbers[0]; } else { timeBudget = numbers[0]; }
+			a++;
+		}
+
+		else if (arg == "-W" || arg == "--workers") {
+			for (size_t begin = 0, end; begin <= value.size(); begin = end + 1) {
+				end = std::min (value.find (',', begin), value.size());
+				if (end > begin) workers.push_back (value.substr (begin, end - begin));
+			}
+			a++;
+		}
+
+		else if (arg == "-t" || arg == "--threads" || arg == "-P" || arg == "--port") {
+			if (! parseNumbers (value, ',', numbers) || numbers.size() != 1 || numbers[0] < 0) { std::cerr << "ERROR: Expected a non-negative integer after option '" << arg << "'" << std::endl; return false; }
+			if (arg == "-t" || arg == "--threads") { threadNb = numbers[0]; } else { port = numbers[0]; }
+			a++;
+		}
+
+		else if (arg == "--hierarchy") { hierarchy = value; a++; }
+		else if (arg == "--values") { distribution = value; a++; }
+
+		else if (arg == "--sizes") {
+			if (! parseNumbers (value, ',', sizes) || *std::min_element (sizes.begin(), sizes.end()) < 1) { std::cerr << "ERROR: Expected positive sizes instead of '" << value << "'" << std::endl; return false; }
+			a++;
+		}
+
+		else if (arg == "--dims" || arg == "--arity" || arg == "--alternatives" || arg == "--density" || arg == "--seed") {
+			if (! parseNumbers (value, ',', numbers) || numbers.size() != 1 || numbers[0] < 0) { std::cerr << "ERROR: Expected a non-negative number after option '" << arg << "'" << std::endl; return false; }
+			if (arg == "--dims") { dimNb = numbers[0]; }
+			else if (arg == "--arity") { arity = numbers[0]; }
+			else if (arg == "--alternatives") { alternativeNb = numbers[0]; }
+			else if (arg == "--density") { density = numbers[0]; }
+			else { seed = numbers[0]; }
+			a++;
+		}
+
+		else if (arg[0] == '-' && arg.size() > 1) { std::cerr << "ERROR: Unknown option '" << arg << "'" << std::endl; return false; }
+		else { dimensions.push_back (arg); }
+	}
+
+	if (command == "bench" || command == "check") {
+		if (dimNb < 1 || (command == "bench" && ! dimensions.empty())) { usage (); return false; }
+		for (std::string &name : dimensions) { if (name != "window" && name != "snapshot" && name != "batch") { std::cerr << "ERROR: Unknown check '" << name << "'" << std::endl; return false; } }
+		if (hierarchy != "tree" && hierarchy != "intervals") { std::cerr << "ERROR: Unknown hierarchy '" << hierarchy << "'" << std::endl; return false; }
+		if (distribution != "uniform" && distribution != "power") { std::cerr << "ERROR: Unknown value distribution '" << distribution << "'" << std::endl; return false; }
+		if (format != "csv" && format != "jsonl") { std::cerr << "ERROR: Benchmarks are written as csv or jsonl" << std::endl; return false; }
+		if (lambdas.empty()) { for (int k = 0; k < 16; k++) lambdas.push_back (0.01 * pow (1e4, k / 15.0)); }
+		if (threadNb < 0) { threadNb = 1; }
+		return true;
+	}
+
+	if (snapshotFile != "" && ! dimensions.empty()) { std::cerr << "ERROR: A snapshot replaces the dimension and values files" << std::endl; return false; }
+	if (snapshotFile == "") {
+		if (dimensions.size() < 2) { usage (); return false; }
+		valueFile = dimensions.back();
+		dimensions.pop_back();
+	}
+
+	if (engine == "") { engine = range ? "path" : "serial"; }
+	if (engine != "serial" && engine != "parallel" && engine != "path" && engine != "anytime" && engine != "batch") { std::cerr << "ERROR: Unknown engine '" << engine << "'" << std::endl; return false; }
+	if (format != "text" && format != "csv" && format != "jsonl" && format != "binary") { std::cerr << "ERROR: Unknown format '" << format << "'" << std::endl; return false; }
+	if (engine != "path" && range) { std::cerr << "ERROR: A range of lambdas requires the path engine" << std::endl; return false; }
+	if (engine == "path" && ! lambdas.empty()) { std::cerr << "ERROR: The path engine takes a range of lambdas, not a grid" << std::endl; return false; }
+
+	if (! workers.empty() && (command != "compress" || engine != "serial")) { std::cerr << "ERROR: Workers only answer the serial engine of a compression" << std::endl; return false; }
+	if ((engine == "anytime" || engine == "batch") && command != "compress") { std::cerr << "ERROR: The " << engine << " engine only answers a compression" << std::endl; return false; }
+	if (engine == "batch" && (! workers.empty() || snapshotFile != "")) { std::cerr << "ERROR: The batch engine reads its values files without workers or snapshots" << std::endl; return false; }
+	if (engine == "batch") {
+		for (size_t begin = 0, end; begin <= valueFile.size(); begin = end + 1) {
+			end = std::min (valueFile.find (',', begin), valueFile.size());
+			if (end > begin) valueFiles.push_back (valueFile.substr (begin, end - begin));
+		}
+	}
+	if ((snapshotFile != "" || saveSnapshotFile != "") && (! workers.empty() || engine == "anytime" || columnDirectory != "")) { std::cerr << "ERROR: Snapshots require an in-memory lattice, without -C, -W or the anytime engine" << std::endl; return false; }
+	if (command == "stream" && snapshotFile == "" && std::count_if (dimensions.begin(), dimensions.end(), [] (std::string &dimension) { return dimension.compare (0, 7, "window:") == 0; }) != 1) { std::cerr << "ERROR: A stream requires exactly one window:STEPS dimension" << std::endl; return false; }
+	if (command == "worker" && port == 0) { std::cerr << "ERROR: A worker requires a port (see -P)" << std::endl; return false; }
+
+	if (lambdas.empty()) { lambdas.push_back (1); }
+	if (threadNb < 0) { threadNb = (engine == "serial" && command != "serve") ? 1 : 0; }
+	return true;
+}
+
+
+void Driver::usage ()
+{
+	std::cerr << "Usage: multidimensional_compression [serve] [options] DIMENSION... VALUES" << std::endl
+			  << "       multidimensional_compression [serve|stream|worker] --snapshot FILE [options]" << std::endl
+			  << "       multidimensional_compression stream [options] DIMENSION... VALUES < SLICES" << std::endl
+			  << "       multidimensional_compression worker -P PORT [options] DIMENSION... VALUES" << std::endl
+			  << "       multidimensional_compression bench [options]" << std::endl
+			  << "       multidimensional_compression check [options] [CHECK...]" << std::endl
+			  << std::endl
+			  << "  DIMENSION              hierarchy file of a dimension, ordered:STEPS[:MAXLENGTH[:GRANULARITY]] or window:STEPS" << std::endl
+			  << "  SLICES                 (stream) lines NAME [FILE] sliding the window onto step NAME with the values of FILE" << std::endl
+			  << "  CHECK                  (check) window, snapshot or batch (default all)" << std::endl
+			  << "  VALUES                 values file, one element per dimension and a value on each line, (batch) FILE[,FILE...]" << std::endl
+			  << std::endl
+			  << "  -l, --lambda L[,L...]  values of lambda (default 1)" << std::endl
+			  << "  -g, --grid MIN:MAX:N   N values of lambda spaced geometrically (linearly if MIN is 0)" << std::endl
+			  << "  -r, --range MIN:MAX    every optimal partition of the regularization path on [MIN, MAX]" << std::endl
+			  << "  -e, --engine NAME      serial, parallel, path, anytime or batch (default serial, path with a range)" << std::endl
+			  << "  -b, --budget SECONDS   (anytime) time spent on each lambda, 0 for no limit (default 1)" << std::endl
+			  << "  --nodes N              (anytime) multi-subsets evaluated for each lambda, 0 for no limit (default 0)" << std::endl
+			  << "  -t, --threads N        worker threads, 0 for one per core (default 1 for the serial engine, 0 otherwise)" << std::endl
+			  << "  -f, --format NAME      text, csv, jsonl or binary (default csv)" << std::endl
+			  << "  -o, --output FILE      write results to FILE instead of the standard output" << std::endl
+			  << "  -s, --sparse           store values in a hash map" << std::endl
+			  << "  -i, --implicit         enumerate lattice partitions on the fly" << std::endl
+			  << "  -p, --prefix-sums      compute losses from prefix sums" << std::endl
+			  << "  --fixed-normalization  (stream) keep losses relative to the initial total so that slides only update the costs they change" << std::endl
+			  << "  -v, --verbose          report each step on the standard error" << std::endl
+			  << "  -R, --report FILE      write timings, counters and memory use as JSON to FILE (- for the standard error)" << std::endl
+			  << "  -C, --columns DIR      keep the lattice and solver columns in memory-mapped files under DIR" << std::endl
+			  << "  -P, --port N           (serve) answer TCP connections on port N instead of the standard input, (worker) listen on port N" << std::endl
+			  << "  -B, --bind ADDRESS     (serve, worker) address to listen on with -P (default 127.0.0.1)" << std::endl
+			  << "  -W, --workers H:P[,...] split the compression into shards computed by the workers at H:P" << std::endl
+			  << "  -D, --shard SET        dimension whose top partition is split into shards (default the last one)" << std::endl
+			  << "  --snapshot FILE        load the lattice from FILE instead of the dimension and values files, (worker) from FILE.DIM.SHARD" << std::endl
+			  << "  --save-snapshot FILE   save the lattice to FILE once built, (worker) each shard to FILE.DIM.SHARD" << std::endl
+			  << std::endl
+			  << "  --dims D               (bench, check) number of dimensions (default 3)" << std::endl
+			  << "  --sizes N[,N...]       (bench, check) elements per dimension of each run (default 4,8,16,32)" << std::endl
+			  << "  --hierarchy NAME       (bench, check) tree or intervals (default tree)" << std::endl
+			  << "  --arity K              (bench, check) children per tree node (default 2)" << std::endl
+			  << "  --alternatives A       (bench, check) extra partitions per tree node (default 0)" << std::endl
+			  << "  --density P            (bench, check) fraction of non-zero cells (default 1)" << std::endl
+			  << "  --values NAME          (bench, check) uniform or power distribution of values (default uniform)" << std::endl
+			  << "  --seed S               (bench, check) seed of the generator (default 1)" << std::endl;
+}
+
+
+MultiSet *Driver::load (int shardDim, int shard, bool values)
+{
+	MultiSet *multiSet = new MultiSet ("M", sparse || ! values);
+	multiSet->fixedNormalization = fixedNormalization;
+
+	int orderedNb = 0;
+	for (std::string &dimension : dimensions) {
+		if (multiSet->dim == shardDim) {
+			if (dimension.compare (0, 8, "ordered:") == 0 || dimension.compare (0, 7, "window:") == 0) { std::cerr << "ERROR: Ordered dimension '" << dimension << "' cannot be split into shards" << std::endl; delete multiSet; return NULL; }
+
+			std::string name = dimension.substr (dimension.find_last_of ('/') + 1);
+			name = name.substr (0, name.find_last_of ('.'));
+			MultiSet fullMultiSet ("full", true);
+			Set *fullSet = new Set (&fullMultiSet, name);
+			if (! fullSet->setElements (dimension)) { delete multiSet; return NULL; }
+
+			Subset *topSubset = fullSet->topSubset;
+			if (topSubset == NULL || topSubset->partitions.size() != 1 || shard >= (int) topSubset->partitions.front()->subsets.size()) {
+				std::cerr << "ERROR: Shards require the top subset of set '" << name << "' to have a single partition" << std::endl;
+				delete multiSet;
+				return NULL;
+			}
+
+			Set *set = new Set (multiSet, name);
+			if (shard < 0) { set->setSubtree (fullSet, topSubset, true); }
+			else { set->setSubtree (fullSet, *std::next (topSubset->partitions.front()->subsets.begin(), shard)); }
+			continue;
+		}
+
+		if (dimension.compare (0, 8, "ordered:") == 0) {
+			std::vector<double> numbers;
+			if (! parseNumbers (std::string_view (dimension).substr (8), ':', numbers) || numbers.empty() || numbers.size() > 3 || numbers[0] < 1) {
+				std::cerr << "ERROR: Expected ordered:STEPS[:MAXLENGTH[:GRANULARITY]] instead of '" << dimension << "'" << std::endl;
+				delete multiSet;
+				return NULL;
+			}
+			Set *set = new Set (multiSet, "T" + std::to_string (orderedNb++));
+			set->setOrdered (numbers[0], (numbers.size() > 1) ? numbers[1] : 0, (numbers.size() > 2) ? numbers[2] : 1);
+			continue;
+		}
+
+		if (dimension.compare (0, 7, "window:") == 0) {
+			std::vector<double> numbers;
+			if (! parseNumbers (std::string_view (dimension).substr (7), ':', numbers) || numbers.size() != 1 || numbers[0] < 1) {
+				std::cerr << "ERROR: Expected window:STEPS instead of '" << dimension << "'" << std::endl;
+				delete multiSet;
+				return NULL;
+			}
+			Set *set = new Set (multiSet, "T" + std::to_string (orderedNb++));
+			set->setWindow (numbers[0]);
+			continue;
+		}
+
+		std::string name = dimension.substr (dimension.find_last_of ('/') + 1);
+		name = name.substr (0, name.find_last_of ('.'));
+		Set *set = new Set (multiSet, name);
+		if (! set->setElements (dimension)) { delete multiSet; return NULL; }
+	}
+
+	multiSet->buildMultiElements ();
+	if (values && ! multiSet->setMultiElements (valueFile, std::max (1, threadNb))) { delete multiSet; return NULL; }
+	return multiSet;
+}
+
+
+MultiSet *Driver::loadSnapshot (std::string filename)
+{
+	MultiSet *multiSet = new MultiSet ("M");
+	if (multiSet->loadSnapshot (filename, threadNb)) return multiSet;
+	delete multiSet;
+	return NULL;
+}
+
+
+int Driver::run ()
+{
+	if (command == "bench" && outputFile == "") { return bench (std::cout); }
+	if (command == "bench") {
+		std::ofstream output (outputFile);
+		if (! output) { std::cerr << "ERROR: Cannot open output file " << outputFile << std::endl; return EXIT_FAILURE; }
+		return bench (output);
+	}
+
+	if (command == "check") { return check (std::cout); }
+
+	if (command == "worker") {
+		Worker worker (this);
+		worker.listen (bindAddress, port);
+		return EXIT_FAILURE;
+	}
+
+	MultiSet *multiSet = (snapshotFile != "") ? loadSnapshot (snapshotFile) : load (-1, -1, workers.empty() && engine != "batch");
+	if (multiSet == NULL) return EXIT_FAILURE;
+	if (verbose) { std::cerr << "Loaded " << multiSet->dim << " dimensions and " << multiSet->multiElementNb << " cells" << std::endl; }
+
+	int status = EXIT_SUCCESS;
+	MultiSet *topMultiSet = NULL;
+	Coordinator *coordinator = NULL;
+	if (workers.empty() && engine != "anytime" && snapshotFile == "") {
+		if (! multiSet->buildLattice (implicit, threadNb, prefixSums, columnDirectory)) { delete multiSet; return EXIT_FAILURE; }
+		if (verbose) { std::cerr << "Built a lattice of " << multiSet->lattice->multiSubsetNb << " multi-subsets" << std::endl; }
+	}
+
+	if (saveSnapshotFile != "") {
+		if (! multiSet->saveSnapshot (saveSnapshotFile)) { delete multiSet; return EXIT_FAILURE; }
+		if (verbose) { std::cerr << "Saved a snapshot to " << saveSnapshotFile << std::endl; }
+	}
+
+	else if (! workers.empty()) {
+		int shardDim = (shardSet == "") ? multiSet->dim - 1 : (multiSet->setsByName.count (shardSet) > 0) ? multiSet->getSet (shardSet)->dim : -1;
+		if (shardDim < 0) { std::cerr << "ERROR: Unknown set '" << shardSet << "'" << std::endl; status = EXIT_FAILURE; }
+		else { topMultiSet = load (shardDim, -1, false); }
+
+		if (topMultiSet != NULL) {
+			coordinator = new Coordinator (multiSet, topMultiSet, shardDim);
+			if (! coordinator->connect (workers) || ! coordinator->computeLoss ()) { status = EXIT_FAILURE; }
+			else if (verbose) { std::cerr << "Gathered " << coordinator->shards.size() << " shards of set '" << multiSet->sets[shardDim]->name << "' from " << workers.size() << " workers" << std::endl; }
+		}
+		else { status = EXIT_FAILURE; }
+
+		if (status != EXIT_SUCCESS) {
+			delete coordinator;
+			delete topMultiSet;
+			delete multiSet;
+			return status;
+		}
+	}
+
+	if (command == "serve") {
+		Server server (multiSet, threadNb);
+		if (port > 0) { server.listen (bindAddress, port); status = EXIT_FAILURE; } else { server.serve (std::cin, std::cout); }
+	}
+
+	else if (outputFile == "") { status = (command == "stream") ? stream (multiSet, std::cin, std::cout) : compress (multiSet, std::cout, coordinator); }
+	else {
+		std::ofstream output (outputFile, std::ios::binary);
+		if (! output) { std::cerr << "ERROR: Cannot open output file " << outputFile << std::endl; status = EXIT_FAILURE; }
+		else { status = (command == "stream") ? stream (multiSet, std::cin, output) : compress (multiSet, output, coordinator); }
+	}
+
+	if (reportFile == "-") { Profile::report (std::cerr, multiSet); }
+	else if (reportFile != "") {
+		std::ofstream report (reportFile);
+		if (report) { Profile::report (report, multiSet); }
+		else { std::cerr << "ERROR: Cannot open report file " << reportFile << std::endl; status = EXIT_FAILURE; }
+	}
+
+	delete coordinator;
+	delete topMultiSet;
+	delete multiSet;
+	return status;
+}
+
+
+int Driver::compress (MultiSet *multiSet, std::ostream &output, Coordinator *coordinator, bool header)
+{
+	Profile profile ("compress");
+	Solver *solver = (coordinator != NULL || multiSet->lattice == NULL) ? NULL : multiSet->lattice->solver;
+	Writer writer (output, (format == "jsonl") ? Writer::JSONL : (format == "binary") ? Writer::BINARY : Writer::CSV);
+	if (format != "text" && header) writer.writeHeader (multiSet);
+	writer.partitionNb = writtenNb;
+
+	long partitionNb = 0;
+	auto write = [&] (MultiPartition *result) {
+		if (format == "text") { output << result->toString (true) << "\n"; } else { writer.write (result); }
+		partitionNb++;
+	};
+
+	if (engine == "path") {
+		for (MultiPartition *result : solver->getRegularizationPath (lambdaMin, lambdaMax)) { write (result); }
+	}
+
+	else if (engine == "anytime") {
+		Anytime anytime (multiSet, timeBudget, nodeBudget);
+		for (double lambda : lambdas) {
+			MultiPartition *result = anytime.getMultiPartition (lambda);
+			result->lambdaMin = result->lambdaMax = lambda;
+			if (verbose) { std::cerr << "Lambda " << lambda << ": cost " << anytime.cost << ", lower bound " << anytime.lowerBound << (anytime.exact ? " (optimal)" : "") << " after " << anytime.ids.size() << " multi-subsets" << std::endl; }
+			write (result);
+		}
+	}
+
+	else if (engine == "batch") {
+		Batch batch (multiSet->lattice, threadNb);
+		for (std::string &filename : valueFiles) { if (batch.addDataset (filename, std::max (1, threadNb)) < 0) return EXIT_FAILURE; }
+		batch.computeLoss ();
+		for (double lambda : lambdas) {
+			for (MultiPartition *result : batch.getMultiPartition (lambda)) {
+				result->lambdaMin = result->lambdaMax = lambda;
+				write (result);
+			}
+		}
+	}
+
+	else if (engine == "parallel") {
+		std::vector<MultiPartition*> results = solver->getMultiPartition (lambdas);
+		for (unsigned int l = 0; l < results.size(); l++) {
+			results[l]->lambdaMin = results[l]->lambdaMax = lambdas[l];
+			write (results[l]);
+		}
+	}
+
+	else {
+		for (double lambda : lambdas) {
+			MultiPartition *result = (coordinator != NULL) ? coordinator->getMultiPartition (lambda) : solver->getMultiPartition (lambda);
+			if (result == NULL) return EXIT_FAILURE;
+			result->lambdaMin = result->lambdaMax = lambda;
+			write (result);
+		}
+	}
+
+	writer.flush ();
+	output.flush ();
+	writtenNb = writer.partitionNb;
+	if (verbose) { std::cerr << "Wrote " << partitionNb << " partitions" << std::endl; }
+	return output ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+int Driver::stream (MultiSet *multiSet, std::istream &input, std::ostream &output)
+{
+	int status = compress (multiSet, output);
+
+	std::string line;
+	while (status == EXIT_SUCCESS && std::getline (input, line)) {
+		std::string_view cursor (line), name, filename;
+		if (! MappedFile::nextToken (cursor, name)) continue;
+		MappedFile::nextToken (cursor, filename);
+
+		if (! multiSet->slideWindow (std::string (name), std::string (filename))) { status = EXIT_FAILURE; break; }
+		if (verbose) { std::cerr << "Slid the window onto step '" << name << "'" << std::endl; }
+		status = compress (multiSet, output, NULL, false);
+	}
+
+	return status;
+}
+
+
+int Driver::bench (std::ostream &output)
+{
+	if (format == "csv") { output << "dims,hierarchy,size,cells,multiSubsets,multiPartitions,phase,wall,cpu,throughput,peakRss" << std::endl; }
+
+	for (double size : sizes) {
+		std::mt19937_64 random (seed);
+		MultiSet *multiSet = NULL;
+		Lattice *lattice = NULL;
+		long cellNb = 0;
+
+		auto measure = [&] (std::string phase, const std::function<void ()> &function) {
+			double wallBegin = Profile::getWallTime ();
+			double cpuBegin = Profile::getCpuTime ();
+			function ();
+			double wall = Profile::getWallTime () - wallBegin;
+			double cpu = Profile::getCpuTime () - cpuBegin;
+			long work = (phase == "generate") ? cellNb : lattice->multiSubsetNb * ((phase == "sweep") ? lambdas.size() : 1);
+			double throughput = (wall > 0) ? work / wall : 0;
+
+			long multiSubsetNb = (lattice != NULL) ? lattice->multiSubsetNb : 0;
+			long multiPartitionNb = (lattice != NULL) ? lattice->multiPartitionNb : 0;
+			if (format == "csv") {
+				output << dimNb << "," << hierarchy << "," << (long) size << "," << cellNb << "," << multiSubsetNb << "," << multiPartitionNb << ","
+					   << phase << "," << wall << "," << cpu << "," << throughput << "," << Profile::getPeakRss () << std::endl;
+			}
+			else {
+				output << "{\"dims\":" << dimNb << ",\"hierarchy\":\"" << hierarchy << "\",\"size\":" << (long) size << ",\"cells\":" << cellNb
+					   << ",\"multiSubsets\":" << multiSubsetNb << ",\"multiPartitions\":" << multiPartitionNb << ",\"phase\":\"" << phase
+					   << "\",\"wall\":" << wall << ",\"cpu\":" << cpu << ",\"throughput\":" << throughput << ",\"peakRss\":" << Profile::getPeakRss () << "}" << std::endl;
+			}
+		};
+
+		measure ("generate", [&] () {
+			multiSet = generate (size, random);
+			cellNb = 0;
+			if (multiSet->sparse) { for (std::pair<const long,MultiElement*> &it : multiSet->sparseMultiElements) { if (it.second->value != 0) cellNb++; } }
+			else { for (MultiElement *multiElement : multiSet->multiElements) { if (multiElement->value != 0) cellNb++; } }
+		});
+		measure ("build", [&] () {
+			lattice = multiSet->lattice = new Lattice (multiSet, implicit, threadNb, prefixSums, columnDirectory);
+			lattice->build ();
+		});
+		if (! lattice->valid) { std::cerr << "ERROR: Cannot build the out-of-core lattice in directory " << columnDirectory << std::endl; delete multiSet; return EXIT_FAILURE; }
+		measure ("loss", [&] () { lattice->computeLoss (); });
+		measure ("cost", [&] () { lattice->solver->getMultiPartition (lambdas[lambdas.size() / 2]); });
+		measure ("sweep", [&] () { lattice->solver->getMultiPartition (lambdas); });
+		measure ("path", [&] () { lattice->solver->getRegularizationPath (lambdas.front(), lambdas.back()); });
+
+		delete multiSet;
+	}
+
+	return output ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+int Driver::check (std::ostream &output)
+{
+	std::vector<std::string> names = dimensions;
+	if (names.empty()) { names = {"window", "snapshot", "batch"}; }
+
+	int status = EXIT_SUCCESS;
+	for (std::string &name : names) {
+		std::mt19937_64 random (seed);
+		std::string error = (name == "window") ? checkWindow (random) : (name == "snapshot") ? checkSnapshot (random) : checkBatch (random);
+		output << name << "\t" << ((error == "") ? "ok" : "FAILED: " + error) << std::endl;
+		if (error != "") { status = EXIT_FAILURE; }
+	}
+	return status;
+}
+
+
+std::string Driver::checkWindow (std::mt19937_64 &random)
+{
+	int size = sizes.front();
+	MultiSet *multiSet = generate (size, random, true);
+	if (! multiSet->buildLattice (true, threadNb)) { delete multiSet; return "cannot build the lattice"; }
+	Set *window = multiSet->sets[dimNb-1];
+
+	std::string filename = createTemporaryFile ();
+	if (filename == "") { delete multiSet; return "cannot create a temporary values file"; }
+
+	std::string error = "";
+	std::vector<std::string> steps;
+	for (int k = 0; k < 2 * size && error == ""; k++) {
+		steps.push_back ("s" + std::to_string (k));
+
+		std::ofstream file (filename);
+		long sliceNb = multiSet->multiElementNb / size;
+		for (long rest = 0; rest < sliceNb; rest++) {
+			std::uniform_real_distribution<double> uniform (0, 1);
+			if (uniform (random) >= density) continue;
+			for (int d = 0; d < dimNb - 1; d++) {
+				Set *set = multiSet->sets[d];
+				long stride = multiSet->elementStrides[d];
+				file << set->elements[(rest / stride) % set->elementNb]->name << "\t";
+			}
+			file << steps.back() << "\t" << drawValue (random) << "\n";
+		}
+		file.close ();
+
+		if (! multiSet->slideWindow (steps.back(), filename)) { error = "cannot slide onto step " + steps.back(); break; }
+		if (k + 1 >= size && window->elements[window->origin % size]->name != steps[k + 1 - size]) { error = "wrong oldest step after " + steps.back(); break; }
+
+		std::mt19937_64 unused (seed);
+		MultiSet *expected = generate (size, unused, true);
+		for (std::string &step : steps) { expected->slideWindow (step); }
+		for (long id = 0; id < multiSet->multiElementNb; id++) { expected->setMultiElement (id, multiSet->getValue (id)); }
+		if (! expected->buildLattice (true, threadNb)) { error = "cannot rebuild the lattice"; }
+		else { error = compare (multiSet, expected); }
+		if (error != "") { error += " after sliding onto " + steps.back(); }
+		delete expected;
+	}
+
+	unlink (filename.c_str());
+	delete multiSet;
+	return error;
+}
+
+
+std::string Driver::checkSnapshot (std::mt19937_64 &random)
+{
+	std::string filename = createTemporaryFile ();
+	if (filename == "") { return "cannot create a temporary snapshot file"; }
+
+	std::string error = "";
+	for (bool implicit : {false, true}) {
+		MultiSet *multiSet = generate (sizes.front(), random);
+		MultiSet *loaded = new MultiSet ("M");
+		if (! multiSet->buildLattice (implicit, threadNb) || ! multiSet->saveSnapshot (filename)) { error = "cannot save the snapshot"; }
+		else if (! loaded->loadSnapshot (filename, threadNb)) { error = "cannot load the snapshot"; }
+		else { error = compare (loaded, multiSet, true); }
+		if (error != "") { error += implicit ? " of an implicit lattice" : " of an explicit lattice"; }
+
+		delete loaded;
+		delete multiSet;
+		if (error != "") break;
+	}
+
+	unlink (filename.c_str());
+	return error;
+}
+
+
+std::string Driver::checkBatch (std::mt19937_64 &random)
+{
+	int size = sizes.front();
+	MultiSet *multiSet = generate (size, random);
+	for (long id = 0; id < multiSet->multiElementNb; id++) { multiSet->setMultiElement (id, 0); }
+	if (! multiSet->buildLattice (false, threadNb)) { delete multiSet; return "cannot build the lattice"; }
+
+	Batch batch (multiSet->lattice, threadNb);
+	std::vector<MultiSet*> datasets;
+	for (int b = 0; b < 10; b++) {
+		datasets.push_back (generate (size, random));
+		datasets.back()->buildLattice (false, threadNb);
+
+		std::vector<std::pair<long,double>> cells;
+		for (long id = 0; id < multiSet->multiElementNb; id++) {
+			double value = datasets.back()->getValue (id);
+			if (value != 0) { cells.push_back (std::pair<long,double> (id, value)); }
+		}
+		batch.addDataset (cells);
+	}
+	batch.computeLoss ();
+
+	std::string error = "";
+	for (double lambda : lambdas) {
+		std::vector<MultiPartition*> results = batch.getMultiPartition (lambda);
+		for (unsigned int b = 0; b < datasets.size() && error == ""; b++) {
+			error = compare (results[b], datasets[b]->lattice->solver->getMultiPartition (lambda));
+			if (error != "") { error += " for dataset " + std::to_string (b) + " and lambda " + std::to_string (lambda); }
+		}
+		if (error != "") break;
+	}
+
+	for (MultiSet *dataset : datasets) { delete dataset; }
+	delete multiSet;
+	return error;
+}
+
+
+std::string Driver::compare (MultiSet *multiSet, MultiSet *expected, bool exact)
+{
+	for (double lambda : lambdas) {
+		std::string error = compare (multiSet->lattice->solver->getMultiPartition (lambda), expected->lattice->solver->getMultiPartition (lambda), exact);
+		if (error != "") return error + " for lambda " + std::to_string (lambda);
+	}
+	return "";
+}
+
+
+std::string Driver::compare (MultiPartition *result, MultiPartition *expected, bool exact)
+{
+	if (exact && result->toString (true) != expected->toString (true)) { return result->toString (true) + " instead of " + expected->toString (true); }
+	if (! (fabs (result->cost - expected->cost) <= 1e-9 * std::max (1.0, fabs (expected->cost)))) {
+		return "cost " + std::to_string (result->cost) + " instead of " + std::to_string (expected->cost) + " (" + result->toString () + " instead of " + expected->toString () + ")";
+	}
+	return "";
+}
+
+
+std::string Driver::createTemporaryFile ()
+{
+	std::string filename = "/tmp/multidimensional_compression_XXXXXX";
+	int fd = mkstemp (&filename[0]);
+	if (fd < 0) return "";
+	close (fd);
+	return filename;
+}
+
+
+MultiSet *Driver::generate (int size, std::mt19937_64 &random, bool window)
+{
+	MultiSet *multiSet = new MultiSet ("bench", sparse);
+	for (int d = 0; d < dimNb; d++) {
+		Set *set = new Set (multiSet, "D" + std::to_string (d));
+		if (window && d == dimNb - 1) { set->setWindow (size); }
+		else if (hierarchy == "intervals") { set->setOrdered (size); } else { set->setTree (size, arity, alternativeNb); }
+	}
+	multiSet->buildMultiElements ();
+
+	auto draw = [&] () { return drawValue (random); };
+
+	if (density >= 1) { for (long id = 0; id < multiSet->multiElementNb; id++) multiSet->setMultiElement (id, draw ()); }
+	else {
+		long cellNb = density * multiSet->multiElementNb;
+		std::unordered_set<long> ids;
+		for (long n = multiSet->multiElementNb - cellNb; n < multiSet->multiElementNb; n++) {
+			long id = std::uniform_int_distribution<long> (0, n) (random);
+			if (! ids.insert (id).second) { id = n; ids.insert (id); }
+			multiSet->setMultiElement (id, draw ());
+		}
+	}
+
+	return multiSet;
+}
+
+
+double Driver::drawValue (std::mt19937_64 &random)
+{
+	double u = std::uniform_real_distribution<double> (0, 1) (random);
+	return (distribution == "power") ? floor (pow (1 - u, -1 / 1.5)) : floor (1 + 100 * u);
+}
+
+
+bool Driver::parseNumbers (std::string_view text, char separator, std::vector<double> &numbers)
+{
+	numbers.clear ();
+	while (true) {
+		std::string_view token = text.substr (0, text.find (separator));
+		double number;
+		std::from_chars_result result = std::from_chars (token.data(), token.data() + token.size(), number);
+		if (token.empty() || result.ec != std::errc() || result.ptr != token.data() + token.size()) return false;
+		numbers.push_back (number);
+		if (token.size() == text.size()) return true;
+		text.remove_prefix (token.size() + 1);
+	}
+}
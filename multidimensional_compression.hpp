@@ -28,9 +28,21 @@
  * program. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <cmath>
+#include <algorithm>
 #include <vector>
+#include <array>
 #include <list>
 #include <map>
+#include <unordered_map>
+#include <string_view>
+#include <functional>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <new>
+#include <ostream>
+#include <random>
 
 class Element;
 class Set;
@@ -40,6 +52,154 @@ class MultiElement;
 class MultiSet;
 class MultiSubset;
 class MultiPartition;
+class Lattice;
+class Segment;
+class Solver;
+class Batch;
+class Anytime;
+class Barrier;
+class Entropy;
+class Writer;
+class Driver;
+class Worker;
+class Coordinator;
+class Connection;
+class Counts;
+class Profile;
+
+
+template <typename T>
+class Column
+{
+public:
+	std::vector<T> values;
+	T *pointer = NULL;
+	long length = 0;
+	int fd = -1;
+
+	Column () {}
+	Column (const Column &) = delete;
+	Column &operator= (const Column &) = delete;
+	~Column () { unmapFile (); }
+
+	void own () { pointer = values.data(); length = values.size(); }
+	void map (T *vPointer, long vLength) { std::vector<T>().swap (values); pointer = vPointer; length = vLength; }
+	bool mapFile (std::string filename);
+	void unmapFile ();
+	bool remap (long n);
+
+	void assign (long n, T value) { if (fd >= 0) { remap (n); std::fill (pointer, pointer + length, value); return; } values.assign (n, value); own (); }
+	void resize (long n) { if (fd >= 0) { remap (n); return; } values.resize (n); own (); }
+	void reserve (long n) { values.reserve (n); own (); }
+	void push_back (T value) { values.push_back (value); own (); }
+	void clear () { if (fd >= 0) { remap (0); return; } values.clear (); own (); }
+
+	T &operator[] (long i) { return pointer[i]; }
+	T *data () { return pointer; }
+	T *begin () { return pointer; }
+	T *end () { return pointer + length; }
+	long size () { return length; }
+	bool empty () { return length == 0; }
+	long bytes () { return values.capacity() * sizeof (T); }
+};
+
+
+template <typename T>
+class Pool
+{
+public:
+	std::vector<T*> blocks;
+	std::vector<T*> released;
+	long blockSize = 1024;
+	long length = 0;
+
+	Pool () {}
+	Pool (const Pool &) = delete;
+	Pool &operator= (const Pool &) = delete;
+	~Pool () { clear (); for (T *block : blocks) { ::operator delete (block); } }
+
+	template <typename... Args> T *create (Args&&... args)
+	{
+		T *object;
+		if (! released.empty()) { object = released.back(); released.pop_back(); object->~T(); }
+		else {
+			if (length == (long) blocks.size() * blockSize) { blocks.push_back ((T *) ::operator new (blockSize * sizeof (T))); }
+			object = blocks[length / blockSize] + length % blockSize;
+			length++;
+		}
+		return new (object) T (std::forward<Args> (args)...);
+	}
+
+	void release (T *object) { released.push_back (object); }
+	void clear () { for (long i = 0; i < length; i++) { blocks[i / blockSize][i % blockSize].~T(); } length = 0; released.clear (); }
+	long size () { return length - released.size(); }
+	long bytes () { return blocks.size() * blockSize * sizeof (T); }
+};
+
+
+// Integer values and element counts below tableSize read n*log2(n) and log2(n) from tables
+// filled with the very expressions of the scalar code, so results are bit-identical to it;
+// any other value falls back to log2.
+class Entropy
+{
+public:
+	static const int tableSize = 1 << 14;
+	static std::vector<double> xLogs;
+	static std::vector<double> logs;
+
+	static std::vector<double> buildTable (bool product);
+
+	static double xlog2x (double value)
+	{
+		if (value >= 0 && value < tableSize && value == (int) value) return xLogs[(int) value];
+		return (value > 0) ? value * log2 (value) : 0;
+	}
+
+	static double log2n (long n) { return (n >= 0 && n < tableSize) ? logs[n] : log2 (n); }
+
+	static void xlog2x (const double *values, double *results, long n);
+};
+
+
+class Counts
+{
+public:
+	long visits = 0;
+	long prunes = 0;
+};
+
+
+class Profile
+{
+public:
+	std::string phase;
+	double wallBegin;
+	double cpuBegin;
+
+	Profile (std::string phase);
+	~Profile ();
+
+	static std::mutex mutex;
+	static std::vector<std::string> phaseNames;
+	static std::map<std::string,std::array<double,3>> phases;
+
+	static std::atomic<long> lossVisits;
+	static std::atomic<long> lossPrunes;
+	static std::atomic<long> lossMemoHits;
+	static std::atomic<long> costVisits;
+	static std::atomic<long> costPrunes;
+	static std::atomic<long> costMemoHits;
+
+	static void add (std::atomic<long> &counter, long n) { counter.fetch_add (n, std::memory_order_relaxed); }
+	static void addLoss (const Counts &counts) { add (lossVisits, counts.visits); add (lossPrunes, counts.prunes); }
+	static void addCost (const Counts &counts) { add (costVisits, counts.visits); add (costPrunes, counts.prunes); }
+
+	static double getWallTime ();
+	static double getCpuTime ();
+	static long getPeakRss ();
+	static void reset ();
+	static void report (std::ostream &output, MultiSet *multiSet = NULL);
+};
 
 
 class Element
@@ -48,6 +208,7 @@ public:
 	Set *set;
 	std::string name;
 	int id;
+	int originalId;
 
 	Element (Set *set, std::string name);
 
@@ -65,21 +226,63 @@ public:
 		
 	std::string name;
 	std::vector<Element*> elements;
-	std::map<std::string,Element*> elementsByName;
+	std::unordered_map<std::string,Element*> elementsByName;
+	Pool<Element> elementPool;
 
 	Subset *topSubset = NULL;
 	std::vector<Subset*> subsets;
-	std::map<std::string,Subset*> subsetsByName;
+	std::unordered_map<std::string,Subset*> subsetsByName;
+	Pool<Subset> subsetPool;
+	Pool<Partition> partitionPool;
+
+	long partitionNb = 0;
+	long partitionSubsetNb = 0;
+	int maxPartitionSize = 0;
+	std::vector<int> partitionOffsets;
+	std::vector<int> subsetOffsets;
+	std::vector<int> subsetIds;
+
+	bool ordered = false;
+	int maxLength = 0;
+	int granularity = 1;
+	int blockNb = 1;
+	std::vector<int> lengthOffsets;
+	std::map<int,Subset*> intervalSubsets;
+	bool windowed = false;
+	long origin = 0;
+	std::mutex subsetMutex;
+	std::vector<std::vector<int>> elementSubsets;
+	std::vector<std::string> foreignElements;
 	
 	Set (MultiSet *multiset, std::string name);
 
-	void setElements (std::string filename);
+	bool setElements (std::string filename);
+	void setOrdered (int stepNb, int maxLength = 0, int granularity = 1);
+	void setWindow (int stepNb);
+	void setTree (int leafNb, int arity = 2, int alternativeNb = 0);
+	void setSubtree (Set *set, Subset *subset, bool collapse = false);
+	int slideWindow (std::string name);
+	bool orderElements ();
+	void buildPartitions ();
+	bool computeHeights ();
 	
 	Element *getElement (int id);
 	Element *getElement (std::string name);
 	Subset *getSubset (int id);
 	Subset *getSubset (std::string name);
 
+	int getTopId ();
+	int getHeight (int id);
+	int getElementId (int id);
+	bool isContiguous (int id);
+	void getElementRange (int id, int &begin, int &end);
+	int getPartitionNb (int id);
+	int getPartitionSubsets (int id, int p, long *subsetIds);
+	void getContainingSubsets (int elementId, std::vector<int> &ids);
+
+	int getIntervalId (int begin, int length);
+	void getInterval (int id, int &begin, int &length);
+
 	std::string toString (bool rec = false);
 };
 
@@ -94,11 +297,17 @@ public:
 	bool top = false;
 	bool bot = false;
 	Element *element = NULL;
+	int height = 0;
+
+	bool contiguous = false;
+	int elementBegin = 0;
+	int elementEnd = 0;
 
 	std::list<Partition*> partitions;
 
 	Subset (Set *set, std::string name, bool vTop = false);
 	Subset (Set *set, std::string name, Element *element, bool vTop = false);
+	Subset (Set *set, int id, std::string name);
 	
 	void getElements (std::list<Element*> &elements);
 
@@ -130,7 +339,7 @@ public:
 	std::vector<Element*> elements;
 
 	MultiSet *multiSet = NULL;
-	int id = 0;
+	long id = 0;
 
 	MultiElement (double value);
 
@@ -145,33 +354,71 @@ class MultiSet
 public:
 	int dim = 0;
 	std::string name;
-	int multiElementNb = 1;
-	int multiSubsetNb = 1;
+	long multiElementNb = 1;
+	long multiSubsetNb = 1;
 
 	std::vector<Set*> sets;
 	std::map<std::string,Set*> setsByName;
 
+	bool sparse = false;
+	std::vector<long> elementStrides;
 	std::vector<MultiElement*> multiElements;
+	std::unordered_map<long,MultiElement*> sparseMultiElements;
+	Pool<MultiElement> multiElementPool;
 
 	MultiSubset *topMultiSubset = NULL;
 	std::vector<MultiSubset*> multiSubsets;
+	std::vector<MultiSubset*> orderedMultiSubsets;
+	bool lazyMultiSubsets = false;
+	std::unordered_map<long,MultiSubset*> multiSubsetsById;
+	Pool<MultiSubset> multiSubsetPool;
+	Pool<MultiPartition> multiPartitionPool;
+	Pool<MultiPartition> resultPool;
+
+	Lattice *lattice = NULL;
+	bool fixedNormalization = false;
+
+	Column<long> cellIds;
+	Column<double> cellValues;
+	void *snapshot = NULL;
+	long snapshotSize = 0;
 
-	MultiSet (std::string name);
+	MultiSet (std::string name, bool sparse = false);
+	~MultiSet ();
 
 	void buildMultiElements ();
-	void buildMultiSubsets ();
+	void buildMultiSubsets (bool lazy = false);
+	bool buildLattice (bool implicit = false, int threadNb = 1, bool prefixSums = false, std::string columnDirectory = "");
 
 	MultiPartition *getMultiPartition (double lambda);
+	MultiPartition *buildMultiPartition (double lambda);
+	std::vector<MultiPartition*> getMultiPartition (const std::vector<double> &lambdas);
+	std::vector<MultiPartition*> getRegularizationPath (double lambdaMin = 0, double lambdaMax = std::numeric_limits<double>::infinity());
 
 	Set *getSet (std::string name);
 
 	void setMultiElement (std::string *names, double value);
-	void setMultiElements (std::string fileName);
+	void setMultiElement (long id, double value);
+	bool setMultiElements (std::string fileName, int threadNb = 1);
+	bool readMultiElements (std::string fileName, std::vector<std::pair<long,double>> &cells, int threadNb = 1);
+	void updateMultiElements (const std::vector<std::pair<long,double>> &updates);
+	bool slideWindow (std::string name, std::string filename = "");
+
+	bool saveSnapshot (std::string filename);
+	bool loadSnapshot (std::string filename, int threadNb = 1);
+	void unmapMultiElements ();
 	
 	MultiElement *getMultiElement (std::string *names);
 	MultiElement *getMultiElement (std::list<Element*>::iterator *elementIterators);
-
-	MultiSubset *getMultiSubset (std::vector<Subset*> subsets);
+	MultiElement *getMultiElement (long id);
+	long getMultiElementId (std::list<Element*>::iterator *elementIterators);
+	long getMultiElementId (std::string *names);
+	double getValue (long id);
+	void aggregate (Subset * const *subsets, double &sumValue, double &sumInfo, long &multiElementNb);
+	void aggregate (Subset * const *subsets, int d, Subset *subset, long id, double &sumValue, double &sumInfo, long &multiElementNb);
+
+	MultiSubset *getMultiSubset (const std::vector<Subset*> &subsets);
+	MultiSubset *addMultiSubset (const std::vector<Subset*> &subsets, long id);
 	
 	std::string toString (bool rec = false);
 };
@@ -180,15 +427,16 @@ public:
 class MultiSubset
 {
 public:
-	int id;
+	long id;
 	int dim = 0;
 	std::vector<Subset*> subsets;
 	MultiSet *multiSet;
 
 	bool top = false;
 	bool bot = false;
+	int level = 0;
 
-	int multiElementNb = 0;
+	long multiElementNb = 0;
 	double sumValue = std::numeric_limits<double>::quiet_NaN();
 	double sumInfo = std::numeric_limits<double>::quiet_NaN();
 
@@ -197,14 +445,16 @@ public:
 	MultiPartition *multiPartition = NULL;
 
 	std::list<MultiPartition*> multiPartitions;
+	bool expanded = false;
 
+	void buildMultiPartitions ();
 	void computeLoss ();
 	void computeCost (double lambda);
 	
 	MultiSubset (MultiSet *multiSet);
 
 	int addSubset (Subset *subset);
-	void getMultiElements (std::list<MultiElement*> &multiElements);
+	long getMultiElements (std::list<MultiElement*> &multiElements);
 
 	std::string toString (bool rec = false);
 };
@@ -220,9 +470,477 @@ public:
 	double loss = 0;
 	double cost = 0;
 
+	double lambdaMin = std::numeric_limits<double>::quiet_NaN();
+	double lambdaMax = std::numeric_limits<double>::quiet_NaN();
+	double lowerBound = std::numeric_limits<double>::quiet_NaN();
+
 	MultiPartition (int dim);
 
 	void addMultiSubset (MultiSubset *multiSubset);
 	
 	std::string toString (bool rec = false);
 };
+
+
+class Lattice
+{
+public:
+	MultiSet *multiSet;
+	int dim;
+	bool implicit = false;
+	int threadNb = 1;
+	bool prefixSums = false;
+	std::string columnDirectory = "";
+	bool outOfCore = false;
+	bool valid = true;
+	bool streaming = false;
+	long multiSubsetNb = 0;
+	long multiPartitionNb = 0;
+	int maxPartitionSize = 0;
+	long topId = 0;
+	std::vector<long> strides;
+
+	int levelNb = 0;
+	Column<long> order;
+	Column<long> levelOffsets;
+
+	Column<long> multiElementNb;
+	Column<double> sumValue;
+	Column<double> sumInfo;
+	Column<double> loss;
+
+	Column<long> multiPartitionOffsets;
+	Column<long> multiSubsetOffsets;
+	Column<long> multiSubsetIds;
+
+	std::vector<long> prefixStrides;
+	std::vector<double> prefixValues;
+	std::vector<double> prefixInfos;
+
+	std::vector<std::vector<char>> emptySubsets;
+	std::vector<std::vector<long>> subsetSizes;
+
+	std::vector<long> activeOrder;
+	std::vector<long> activeLevelOffsets;
+	std::atomic<bool> activeStale {true};
+	long activeVersion = 0;
+	std::mutex activeMutex;
+
+	double normalization = 1;
+	bool fixedNormalization = false;
+
+	Solver *solver = NULL;
+	std::list<Solver*> solvers;
+	std::mutex solverMutex;
+
+	std::vector<std::thread> poolThreads;
+	Barrier *poolBarrier = NULL;
+	std::function<void ()> poolTask;
+	int poolWorkerNb = 0;
+	std::mutex poolMutex;
+
+	Lattice (MultiSet *multiSet, bool implicit = false, int threadNb = 1, bool prefixSums = false, std::string columnDirectory = "");
+	~Lattice ();
+
+	bool build ();
+	void buildOrder ();
+	void buildPrefixSums ();
+	void buildActiveOrder ();
+	void sweep (const std::function<void (const long *order, long nb, long *ids)> &function, bool levels = true, int workerNb = 0, bool active = false);
+	void runPool (const std::function<void ()> &worker, int workerNb);
+	void stopPool ();
+	std::string getColumnFile (const void *owner, std::string name);
+	long getActiveNb ();
+	template <typename Function> void withKernel (Function function);
+
+	void computeLoss ();
+	void computeLoss (const std::vector<double> &values, const std::vector<double> &infos, const std::vector<long> &elementNbs);
+	void findEmptySubsets ();
+	static double getLoss (double value, double info, long elementNb);
+	double getLossScale ();
+	void updateValue (long cellId, double oldValue, double newValue);
+	void slideWindow (int d);
+
+	MultiPartition *getMultiPartition (double lambda);
+	std::vector<MultiPartition*> getMultiPartition (const std::vector<double> &lambdas);
+	std::vector<MultiPartition*> getRegularizationPath (double lambdaMin, double lambdaMax);
+
+	int getSubsetId (long id, int d);
+	int getMultiPartitionNb (long id);
+	int getMultiSubsetIds (long id, int k, long *ids);
+	MultiSubset *getMultiSubset (long id, Pool<MultiSubset> &pool);
+};
+
+
+class Solver
+{
+public:
+	Lattice *lattice;
+	int threadNb = 1;
+	bool valid = true;
+
+	double costLambda = std::numeric_limits<double>::quiet_NaN();
+	long activeVersion = -1;
+	long laneActiveVersion = -1;
+	Column<double> cost;
+	Column<int> multiPartition;
+	std::vector<bool> dirty;
+	std::vector<long> dirtyIds;
+
+	int laneNb = 0;
+	std::vector<double> lambdas;
+	Column<double> laneCosts;
+	Column<int> laneMultiPartitions;
+	const double *laneLosses = NULL;
+	const double *splitCosts = NULL;
+
+	double pathLambdaMin = 0;
+	double pathLambdaMax = 0;
+	std::vector<Segment> segments;
+	Column<long> segmentBegins;
+	Column<long> segmentEnds;
+
+	std::vector<long> ids;
+	std::vector<long> positions;
+	std::vector<Segment> lines;
+
+	Pool<MultiSubset> viewPool;
+	Pool<MultiPartition> resultPool;
+
+	Solver (Lattice *lattice, int threadNb = 1);
+	~Solver ();
+
+	void reset ();
+	void markDirty (long id);
+	void releaseResults ();
+
+	void computeCost (double lambda);
+	MultiPartition *getMultiPartition (double lambda, long rootId = -1);
+
+	void computeCosts (const std::vector<double> &lambdas);
+	void computeCosts (long id, long *ids, Counts &counts);
+	std::vector<MultiPartition*> getMultiPartition (const std::vector<double> &lambdas);
+
+	void computePath (double lambdaMin, double lambdaMax);
+	void computePath (long id, std::vector<Segment> &lines, long *ids, long *positions);
+	void computeEnvelope (std::vector<Segment> &lines);
+	long getSegment (long id, double lambda);
+	std::vector<MultiPartition*> getRegularizationPath (double lambdaMin, double lambdaMax);
+};
+
+
+class Batch
+{
+public:
+	Lattice *lattice;
+	Solver solver;
+	int datasetNb = 0;
+	int laneNb = 0;
+
+	std::vector<std::vector<std::pair<long,double>>> datasets;
+	std::unordered_map<long,long> cellRows;
+	std::vector<double> cellValues;
+
+	std::vector<double> sumValues;
+	std::vector<double> sumInfos;
+	std::vector<double> losses;
+
+	Pool<MultiSubset> viewPool;
+	Pool<MultiPartition> resultPool;
+
+	Batch (Lattice *lattice, int threadNb = 1);
+
+	int addDataset (std::string filename, int threadNb = 1);
+	int addDataset (const std::vector<std::pair<long,double>> &cells);
+
+	void computeLoss ();
+	void computeLoss (long id, long *ids);
+	std::vector<MultiPartition*> getMultiPartition (double lambda);
+};
+
+
+class Anytime
+{
+public:
+	MultiSet *multiSet;
+	int dim;
+	double timeBudget = 1;
+	long nodeBudget = 0;
+
+	std::vector<long> strides;
+	std::vector<int> topIds;
+	int maxPartitionSize = 0;
+
+	std::unordered_map<long,long> nodes;
+	std::vector<long> ids;
+	std::vector<double> values;
+	std::vector<double> infos;
+	std::vector<long> elementNbs;
+	std::vector<double> losses;
+	std::vector<int> minSizes;
+	std::vector<long> partitionBegins;
+	std::vector<long> partitionEnds;
+	std::vector<long> partitionNodes;
+
+	double cost = std::numeric_limits<double>::quiet_NaN();
+	double lowerBound = std::numeric_limits<double>::quiet_NaN();
+	bool exact = false;
+
+	Pool<MultiSubset> viewPool;
+	Pool<MultiPartition> resultPool;
+
+	Anytime (MultiSet *multiSet, double timeBudget = 1, long nodeBudget = 0);
+
+	long getNode (long id);
+	void expand (long node);
+	MultiPartition *getMultiPartition (double lambda);
+};
+
+
+template <int D>
+class LatticeKernel
+{
+public:
+	static const int maxDim = 64;
+	static const int capacity = (D > 0) ? D : maxDim;
+
+	Lattice *lattice;
+	int dim;
+	std::array<Set*,capacity> sets;
+	std::array<long,capacity> strides;
+	std::array<int,capacity> subsetNbs;
+
+	LatticeKernel (Lattice *lattice);
+
+	int getDim () { return (D > 0) ? D : dim; }
+	void getSubsetIds (long id, std::array<int,capacity> &subsetIds);
+	bool computeEmptyLoss (long id, const std::array<int,capacity> &subsetIds);
+	void computeLoss (long id, long *ids, Counts &counts);
+	void computePrefixLoss (long id, Counts &counts);
+	void computeCost (Solver *solver, long id, double lambda, long *ids, Counts &counts);
+};
+
+
+class Segment
+{
+public:
+	double lambda;
+	int size;
+	double loss;
+	int multiPartition;
+
+	Segment (double lambda, int size, double loss, int multiPartition);
+};
+
+
+class Writer
+{
+public:
+	enum Format { CSV, JSONL, BINARY };
+
+	std::ostream *output = NULL;
+	int fd = -1;
+	Format format;
+	long partitionNb = 0;
+
+	static const int bufferSize = 1 << 16;
+	char buffer [bufferSize];
+	int length = 0;
+
+	Writer (std::ostream &output, Format format = CSV);
+	Writer (int fd, Format format = CSV);
+	Writer (const Writer &) = delete;
+	Writer &operator= (const Writer &) = delete;
+	~Writer ();
+
+	void writeHeader (MultiSet *multiSet);
+	void write (MultiPartition *multiPartition);
+	void flush ();
+
+	void put (const char *data, long size);
+	void put (std::string_view text) { put (text.data(), text.size()); }
+	void put (char c) { if (length == bufferSize) flush (); buffer[length++] = c; }
+	void putNumber (long value);
+	void putNumber (double value);
+	void putName (std::string_view name);
+	template <typename T> void putBinary (T value) { put ((const char *) &value, sizeof (T)); }
+};
+
+
+class Connection
+{
+public:
+	int client;
+	std::string buffer;
+	std::string request;
+	MultiSet *multiSet = NULL;
+	int shardDim = -1;
+
+	Connection (int client);
+	~Connection ();
+};
+
+
+class Server
+{
+public:
+	MultiSet *multiSet;
+	int threadNb = 1;
+	std::mutex outputMutex;
+
+	Server (MultiSet *multiSet, int threadNb = 1);
+
+	std::string answer (const std::string &request, Solver &solver);
+	void serve (std::istream &input, std::ostream &output);
+	void listen (std::string host, int port);
+
+	static void acceptRequests (int server, int threadNb, const std::function<void (const std::function<Connection* (Connection *previous, bool open)> &nextRequest)> &worker);
+	static int openSocket (std::string host, int port);
+	static int connectSocket (std::string address);
+	static bool sendAll (int client, const std::string &data);
+	static bool receiveLine (int client, std::string &buffer, std::string &line);
+};
+
+
+class Worker
+{
+public:
+	Driver *driver;
+
+	Worker (Driver *driver);
+
+	void listen (std::string host, int port);
+	std::string answer (const std::string &request, MultiSet *&multiSet, int &shardDim);
+	long getSliceId (Lattice *lattice, int shardDim, long x);
+};
+
+
+class Coordinator
+{
+public:
+	MultiSet *multiSet;
+	MultiSet *topMultiSet;
+	Lattice *lattice;
+	int shardDim;
+
+	std::vector<Subset*> shards;
+	std::vector<long> shardSizes;
+	long elementNb = 0;
+	std::vector<int> clients;
+	std::vector<std::string> buffers;
+	std::vector<double> totals;
+	double total = 0;
+	std::vector<double> splitCosts;
+
+	Pool<MultiSubset> viewPool;
+	Pool<MultiPartition> resultPool;
+
+	Coordinator (MultiSet *multiSet, MultiSet *topMultiSet, int shardDim);
+	~Coordinator ();
+
+	bool connect (const std::vector<std::string> &addresses);
+	bool computeLoss ();
+	MultiPartition *getMultiPartition (double lambda);
+
+	bool receive (int s, std::string &line);
+	bool receiveCount (int s, long &count);
+	bool invalid (int s, const std::string &line);
+	template <typename T> static bool readNumber (std::string_view &line, T &number);
+	static std::string toString (double number);
+};
+
+
+class MappedFile
+{
+public:
+	char *data = NULL;
+	long size = 0;
+	bool valid = false;
+
+	MappedFile (std::string filename);
+	~MappedFile ();
+
+	static bool nextLine (const char *&cursor, const char *end, std::string_view &line);
+	static bool nextToken (std::string_view &line, std::string_view &token);
+};
+
+
+class Barrier
+{
+public:
+	int threadNb;
+	int waitingNb = 0;
+	long generation = 0;
+	std::mutex mutex;
+	std::condition_variable condition;
+
+	Barrier (int threadNb);
+
+	void wait ();
+};
+
+
+class Driver
+{
+public:
+	std::string command = "compress";
+	std::vector<std::string> dimensions;
+	std::string valueFile;
+	std::vector<std::string> valueFiles;
+
+	std::vector<double> lambdas;
+	double lambdaMin = 0;
+	double lambdaMax = std::numeric_limits<double>::infinity();
+	bool range = false;
+
+	std::string engine = "";
+	std::string format = "csv";
+	std::string outputFile = "";
+	std::string reportFile = "";
+	std::string columnDirectory = "";
+	std::string snapshotFile = "";
+	std::string saveSnapshotFile = "";
+	int threadNb = -1;
+	int port = 0;
+	std::string bindAddress = "127.0.0.1";
+	std::vector<std::string> workers;
+	std::string shardSet = "";
+	double timeBudget = 1;
+	long nodeBudget = 0;
+	long writtenNb = 0;
+
+	bool sparse = false;
+	bool implicit = false;
+	bool prefixSums = false;
+	bool fixedNormalization = false;
+	bool verbose = false;
+
+	int dimNb = 3;
+	std::vector<double> sizes = {4, 8, 16, 32};
+	std::string hierarchy = "tree";
+	int arity = 2;
+	int alternativeNb = 0;
+	double density = 1;
+	std::string distribution = "uniform";
+	long seed = 1;
+
+	bool parse (int argc, char *argv[]);
+	void usage ();
+	MultiSet *load (int shardDim = -1, int shard = -1, bool values = true);
+	MultiSet *loadSnapshot (std::string filename);
+	int run ();
+	int compress (MultiSet *multiSet, std::ostream &output, Coordinator *coordinator = NULL, bool header = true);
+	int stream (MultiSet *multiSet, std::istream &input, std::ostream &output);
+	int bench (std::ostream &output);
+	int check (std::ostream &output);
+	std::string checkWindow (std::mt19937_64 &random);
+	std::string checkSnapshot (std::mt19937_64 &random);
+	std::string checkBatch (std::mt19937_64 &random);
+	std::string compare (MultiSet *multiSet, MultiSet *expected, bool exact = false);
+	std::string compare (MultiPartition *result, MultiPartition *expected, bool exact = false);
+	std::string createTemporaryFile ();
+	MultiSet *generate (int size, std::mt19937_64 &random, bool window = false);
+	double drawValue (std::mt19937_64 &random);
+
+	static bool parseNumbers (std::string_view text, char separator, std::vector<double> &numbers);
+};